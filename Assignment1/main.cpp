@@ -2,7 +2,16 @@
 #include "rasterizer.hpp"
 #include <eigen3/Eigen/Eigen>
 #include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <future>
 #include <iostream>
+#include <mutex>
+#include <thread>
 
 constexpr double MY_PI = 3.1415926;
 const int WIDTH = 700, HEIGHT = 700;
@@ -60,8 +69,68 @@ Eigen::Matrix4f get_projection_matrix(float eye_fov, float aspect_ratio, float z
 	return projection;
 }
 
+// milliseconds since start
+double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Headless turntable: renders the angles start, start + step, ... up to end with one rasterizer
+// per thread and writes <prefix>_<frame>.png. Frames are encoded in parallel and written in order.
+void render_turntable(float start, float end, float step, const std::string &prefix)
+{
+	int frames = step > 0 ? (int)std::floor((end - start) / step + 1e-4f) + 1 : 1;
+	int threads = std::min(frames, std::max(1, (int)std::thread::hardware_concurrency()));
+
+	std::atomic<int> next_frame{ 0 };
+	int next_write = 0;
+	std::mutex mutex;
+	std::condition_variable written;
+
+	auto worker = [&]() {
+		rst::rasterizer r(WIDTH, HEIGHT);
+		r.set_packed_output(true, rst::PixelOrder::BGRA);
+		auto pos_id = r.load_positions({ {2, 0, -2}, {0, 2, -2}, {-2, 0, -2} });
+		auto ind_id = r.load_indices({ {0, 1, 2} });
+		r.set_view(get_view_matrix({ 0, 0, 5 }));
+		r.set_projection(get_projection_matrix(45, 1, 0.1, 50));
+
+		std::vector<uchar> png;
+		for (int f = next_frame++; f < frames; f = next_frame++)
+		{
+			r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+			r.set_model(get_model_matrix(start + f * step));
+			r.draw(pos_id, ind_id, rst::Primitive::Triangle);
+			cv::Mat image(HEIGHT, WIDTH, CV_8UC4, r.packed_frame_buffer().data());
+			cv::imencode(".png", image, png);
+
+			char name[32];
+			std::snprintf(name, sizeof(name), "_%04d.png", f);
+			std::unique_lock<std::mutex> lock(mutex);
+			written.wait(lock, [&] { return next_write == f; });
+			std::ofstream(prefix + name, std::ios::binary).write((const char *)png.data(), png.size());
+			std::cout << prefix + name << '\n';
+			next_write++;
+			written.notify_all();
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (int i = 1; i < threads; i++)
+		pool.emplace_back(worker);
+	worker();
+	for (auto &t : pool)
+		t.join();
+}
+
 int main(int argc, const char **argv)
 {
+	// -b start end step [prefix]
+	if (argc >= 5 && std::string(argv[1]) == "-b")
+	{
+		render_turntable(std::stof(argv[2]), std::stof(argv[3]), std::stof(argv[4]), argc >= 6 ? argv[5] : "output");
+		return 0;
+	}
 
 	float angle = 0;
 	bool command_line = false;
@@ -77,6 +146,7 @@ int main(int argc, const char **argv)
 		}
 	}
 	rst::rasterizer r(WIDTH, HEIGHT);
+	r.set_packed_output(true, rst::PixelOrder::BGRA);
 
 	Eigen::Vector3f eye_pos = { 0, 0, 5 };
 
@@ -99,31 +169,44 @@ int main(int argc, const char **argv)
 		r.set_projection(get_projection_matrix(45, 1, 0.1, 50));
 
 		r.draw(pos_id, ind_id, rst::Primitive::Triangle);
-		cv::Mat image(700, 700, CV_32FC3, r.frame_buffer().data());
-		image.convertTo(image, CV_8UC3, 1.0f);
+		cv::Mat image(700, 700, CV_8UC4, r.packed_frame_buffer().data());
 
 		cv::imwrite(filename, image);
 		return 0;
 	}
 
-	while (key != 27)
-	{
+	// Double buffered: frame N + 1 renders on a worker thread while frame N is shown,
+	// so a key press takes effect one frame later
+	auto render = [&](float frame_angle) {
+		auto start = std::chrono::steady_clock::now();
 		r.clear(rst::Buffers::Color | rst::Buffers::Depth);
 
-		r.set_model(get_model_matrix(angle));
+		r.set_model(get_model_matrix(frame_angle));
 		r.set_view(get_view_matrix(eye_pos));
 		r.set_projection(get_projection_matrix(45, 1, 0.1, 50));
 
 		r.draw(pos_id, ind_id, rst::Primitive::Triangle);
+		return elapsed_ms(start);
+	};
+	std::vector<unsigned char> front(r.packed_frame_buffer().size());
+	std::future<double> rendering = std::async(std::launch::async, render, angle);
 
-		cv::Mat image(700, 700, CV_32FC3, r.frame_buffer().data());
-		image.convertTo(image, CV_8UC3, 1.0f);
+	while (key != 27)
+	{
+		auto frame_start = std::chrono::steady_clock::now();
+		double render_ms = rendering.get();
+		std::swap(front, r.packed_frame_buffer());
+		angle += 10;
+		rendering = std::async(std::launch::async, render, angle);
+
+		auto display_start = std::chrono::steady_clock::now();
+		cv::Mat image(700, 700, CV_8UC4, front.data());
 		cv::imshow("image", image);
 		key = cv::waitKey(10);
+		double display_ms = elapsed_ms(display_start);
 
-		std::cout << "frame count: " << frame_count++ << '\n';
-
-		angle += 10;
+		std::cout << "frame count: " << frame_count++ << ", render " << render_ms << " ms, display " << display_ms
+			<< " ms, frame " << elapsed_ms(frame_start) << " ms\n";
 
 		if (key == 'a')
 		{
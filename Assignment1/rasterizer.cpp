@@ -200,7 +200,15 @@ void rst::rasterizer::clear(rst::Buffers buff)
 {
 	if ((buff & rst::Buffers::Color) == rst::Buffers::Color)
 	{
-		std::fill(frame_buf.begin(), frame_buf.end(), Eigen::Vector3f{ 0, 0, 0 });
+		if (packed)
+		{
+			for (int i = 0; i < width * height; i++)
+				pack_pixel(i, Eigen::Vector3f{ 0, 0, 0 });
+		}
+		else
+		{
+			std::fill(frame_buf.begin(), frame_buf.end(), Eigen::Vector3f{ 0, 0, 0 });
+		}
 	}
 	if ((buff & rst::Buffers::Depth) == rst::Buffers::Depth)
 	{
@@ -223,6 +231,35 @@ void rst::rasterizer::set_pixel(int x, int y, const Eigen::Vector3f &color)
 {
 	if (x < 0 || x >= width || y < 0 || y >= height) return;
 
-	frame_buf[get_index(x, y)] = color;
+	if (packed)
+		pack_pixel(get_index(x, y), color);
+	else
+		frame_buf[get_index(x, y)] = color;
+}
+
+void rst::rasterizer::set_packed_output(bool enable, PixelOrder order)
+{
+	packed = enable;
+	red_offset = order == PixelOrder::RGBA ? 0 : 2;
+	blue_offset = 2 - red_offset;
+	packed_buf.assign(enable ? 4 * width * height : 0, 0);
+}
+
+// rounds and saturates like cv::Mat::convertTo to CV_8U
+static unsigned char to_unorm8(float v)
+{
+	v += 0.5f;
+	if (!(v > 0))
+		return 0;
+	return v >= 255 ? 255 : (unsigned char)v;
+}
+
+void rst::rasterizer::pack_pixel(int ind, const Eigen::Vector3f &color)
+{
+	unsigned char *p = &packed_buf[ind * 4];
+	p[red_offset] = to_unorm8(color.x());
+	p[1] = to_unorm8(color.y());
+	p[blue_offset] = to_unorm8(color.z());
+	p[3] = 255;
 }
 
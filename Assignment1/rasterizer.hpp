@@ -28,6 +28,13 @@ namespace rst
 		Triangle
 	};
 
+	// byte order of a pixel in the packed 8-bit frame buffer
+	enum class PixelOrder
+	{
+		RGBA,
+		BGRA
+	};
+
 	/*
 	 * For the curious : The draw function takes two buffer id's as its arguments.
 	 * These two structs make sure that if you mix up with their orders, the
@@ -61,10 +68,16 @@ namespace rst
 		void draw(pos_buf_id pos_buffer, ind_buf_id ind_buffer, Primitive type);
 
 		std::vector<Eigen::Vector3f> &frame_buffer() { return frame_buf; }
+		// Packed mode: set_pixel rounds to 8 bits and writes straight into packed_frame_buffer(),
+		// 4 bytes per pixel in the given order with alpha 255; frame_buffer() is left untouched.
+		// The buffer can be wrapped in a CV_8UC4 cv::Mat without copying.
+		void set_packed_output(bool enable, PixelOrder order = PixelOrder::BGRA);
+		std::vector<unsigned char> &packed_frame_buffer() { return packed_buf; }
 
 		int get_index(int x, int y);
 
 	private:
+		void pack_pixel(int ind, const Eigen::Vector3f &color);
 		void draw_line(const Eigen::Vector3f &begin, const Eigen::Vector3f &end);
 		void rasterize_wireframe(const Triangle &t);
 
@@ -77,6 +90,9 @@ namespace rst
 		std::map<int, std::vector<Eigen::Vector3i>> ind_buf;
 
 		std::vector<Eigen::Vector3f> frame_buf;
+		std::vector<unsigned char> packed_buf;
+		bool packed = false;
+		int red_offset = 2, blue_offset = 0;
 		std::vector<float> depth_buf;
 
 		int width, height;
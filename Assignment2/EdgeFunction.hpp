@@ -0,0 +1,204 @@
+#ifndef RASTERIZER_EDGEFUNCTION_H
+#define RASTERIZER_EDGEFUNCTION_H
+
+#include <eigen3/Eigen/Eigen>
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define RST_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RST_SIMD_SSE
+#endif
+
+namespace rst
+{
+	// Edge equations of a screen space triangle, set up once per triangle.
+	// E[k](x, y) = a[k] * x + b[k] * y + c[k], where edge 0 is v1->v2, edge 1 is v2->v0 and edge 2 is v0->v1,
+	// so E[k](p) / E[k](v[k]) is the k-th barycentric coordinate of p.
+	struct edge_equations
+	{
+		float a[3], b[3], c[3];
+		float inv_area[3];
+		// barycentric gradients, d(alpha, beta, gamma) / dx and / dy
+		float dbdx[3], dbdy[3];
+	};
+
+	// 8 horizontally adjacent pixels evaluated at once
+	struct raster_block
+	{
+		unsigned coverage[8]; // bit s is set if sample s of the pixel is inside the triangle
+		float alpha[8], beta[8], gamma[8]; // barycentrics at the pixel center
+	};
+
+	// Sample positions inside a pixel, in [0, 1)
+	struct sample_pattern
+	{
+		int count;
+		float x[16], y[16];
+	};
+
+	// The standard D3D multisample patterns for 1, 2, 4, 8 and 16 samples.
+	// Returns false for any other sample count.
+	inline bool standard_sample_pattern(int count, sample_pattern &p)
+	{
+		// offsets from the pixel center in 1/16 pixel
+		static const int pattern1[][2] = { { 0, 0 } };
+		static const int pattern2[][2] = { { 4, 4 }, { -4, -4 } };
+		static const int pattern4[][2] = { { -2, -6 }, { 6, -2 }, { -6, 2 }, { 2, 6 } };
+		static const int pattern8[][2] = { { 1, -3 }, { -1, 3 }, { 5, 1 }, { -3, -5 }, { -5, 5 }, { -7, -1 }, { 3, 7 }, { 7, -7 } };
+		static const int pattern16[][2] = {
+			{ 1, 1 }, { -1, -3 }, { -3, 2 }, { 4, -1 }, { -5, -2 }, { 2, 5 }, { 5, 3 }, { 3, -5 },
+			{ -2, 6 }, { 0, -7 }, { -4, -6 }, { -6, 4 }, { -8, 0 }, { 7, -4 }, { 6, 7 }, { -7, -8 }
+		};
+		const int(*offsets)[2];
+		switch (count)
+		{
+		case 1: offsets = pattern1; break;
+		case 2: offsets = pattern2; break;
+		case 4: offsets = pattern4; break;
+		case 8: offsets = pattern8; break;
+		case 16: offsets = pattern16; break;
+		default: return false;
+		}
+		p.count = count;
+		for (int s = 0; s < count; s++)
+		{
+			p.x[s] = 0.5f + offsets[s][0] / 16.0f;
+			p.y[s] = 0.5f + offsets[s][1] / 16.0f;
+		}
+		return true;
+	}
+
+	inline int count_bits(unsigned mask)
+	{
+		int n = 0;
+		for (; mask; mask &= mask - 1)
+			n++;
+		return n;
+	}
+
+	// Returns false for degenerate triangles, which cover no samples.
+	template <typename Vec>
+	inline bool setup_edges(const Vec *v, edge_equations &e)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			const Vec &p = v[(k + 1) % 3];
+			const Vec &q = v[(k + 2) % 3];
+			e.a[k] = p.y() - q.y();
+			e.b[k] = q.x() - p.x();
+			e.c[k] = p.x() * q.y() - q.x() * p.y();
+			float area = e.a[k] * v[k].x() + e.b[k] * v[k].y() + e.c[k];
+			if (area == 0 || !std::isfinite(area))
+				return false;
+			e.inv_area[k] = 1.0f / area;
+			e.dbdx[k] = e.a[k] * e.inv_area[k];
+			e.dbdy[k] = e.b[k] * e.inv_area[k];
+		}
+		return true;
+	}
+
+	// A sample is inside when all three edge functions are > 0 or all are <= 0,
+	// the same rule insideTriangle uses, so both windings are accepted.
+	inline void eval_block8(const edge_equations &e, int x, int y, const float *sx, const float *sy, int num_samples, raster_block &out)
+	{
+		unsigned sample_bits[16];
+#if defined(RST_SIMD_AVX2)
+		const __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+		const __m256 zero = _mm256_setzero_ps();
+		__m256 xs = _mm256_add_ps(_mm256_set1_ps((float)x), lane);
+		__m256 a[3], row[3];
+		for (int k = 0; k < 3; k++)
+			a[k] = _mm256_set1_ps(e.a[k]);
+		for (int s = 0; s < num_samples; s++)
+		{
+			__m256 px = _mm256_add_ps(xs, _mm256_set1_ps(sx[s]));
+			float py = y + sy[s];
+			__m256 pos = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			__m256 neg = pos;
+			for (int k = 0; k < 3; k++)
+			{
+				__m256 ek = _mm256_add_ps(_mm256_mul_ps(a[k], px), _mm256_set1_ps(e.b[k] * py + e.c[k]));
+				pos = _mm256_and_ps(pos, _mm256_cmp_ps(ek, zero, _CMP_GT_OQ));
+				neg = _mm256_and_ps(neg, _mm256_cmp_ps(ek, zero, _CMP_LE_OQ));
+			}
+			sample_bits[s] = (unsigned)_mm256_movemask_ps(_mm256_or_ps(pos, neg));
+		}
+		__m256 pcx = _mm256_add_ps(xs, _mm256_set1_ps(0.5f));
+		float pcy = y + 0.5f;
+		float *bary[3] = { out.alpha, out.beta, out.gamma };
+		for (int k = 0; k < 3; k++)
+		{
+			row[k] = _mm256_set1_ps(e.b[k] * pcy + e.c[k]);
+			__m256 ek = _mm256_add_ps(_mm256_mul_ps(a[k], pcx), row[k]);
+			_mm256_storeu_ps(bary[k], _mm256_mul_ps(ek, _mm256_set1_ps(e.inv_area[k])));
+		}
+#elif defined(RST_SIMD_SSE)
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 all = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		float *bary[3] = { out.alpha, out.beta, out.gamma };
+		for (int s = 0; s < num_samples; s++)
+			sample_bits[s] = 0;
+		for (int half = 0; half < 2; half++)
+		{
+			__m128 xs = _mm_add_ps(_mm_set1_ps((float)(x + half * 4)), _mm_setr_ps(0, 1, 2, 3));
+			for (int s = 0; s < num_samples; s++)
+			{
+				__m128 px = _mm_add_ps(xs, _mm_set1_ps(sx[s]));
+				float py = y + sy[s];
+				__m128 pos = all, neg = all;
+				for (int k = 0; k < 3; k++)
+				{
+					__m128 ek = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e.a[k]), px), _mm_set1_ps(e.b[k] * py + e.c[k]));
+					pos = _mm_and_ps(pos, _mm_cmpgt_ps(ek, zero));
+					neg = _mm_and_ps(neg, _mm_cmple_ps(ek, zero));
+				}
+				sample_bits[s] |= (unsigned)_mm_movemask_ps(_mm_or_ps(pos, neg)) << (half * 4);
+			}
+			__m128 pcx = _mm_add_ps(xs, _mm_set1_ps(0.5f));
+			float pcy = y + 0.5f;
+			for (int k = 0; k < 3; k++)
+			{
+				__m128 ek = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e.a[k]), pcx), _mm_set1_ps(e.b[k] * pcy + e.c[k]));
+				_mm_storeu_ps(bary[k] + half * 4, _mm_mul_ps(ek, _mm_set1_ps(e.inv_area[k])));
+			}
+		}
+#else
+		float *bary[3] = { out.alpha, out.beta, out.gamma };
+		for (int s = 0; s < num_samples; s++)
+		{
+			sample_bits[s] = 0;
+			float py = y + sy[s];
+			for (int l = 0; l < 8; l++)
+			{
+				float px = (float)x + l + sx[s];
+				bool pos = true, neg = true;
+				for (int k = 0; k < 3; k++)
+				{
+					float ek = e.a[k] * px + (e.b[k] * py + e.c[k]);
+					pos = pos && ek > 0;
+					neg = neg && ek <= 0;
+				}
+				sample_bits[s] |= (unsigned)(pos || neg) << l;
+			}
+		}
+		for (int k = 0; k < 3; k++)
+		{
+			float row = e.b[k] * (y + 0.5f) + e.c[k];
+			for (int l = 0; l < 8; l++)
+				bary[k][l] = (e.a[k] * ((float)x + l + 0.5f) + row) * e.inv_area[k];
+		}
+#endif
+		for (int l = 0; l < 8; l++)
+		{
+			unsigned mask = 0;
+			for (int s = 0; s < num_samples; s++)
+				mask |= ((sample_bits[s] >> l) & 1u) << s;
+			out.coverage[l] = mask;
+		}
+	}
+} // namespace rst
+
+#endif //RASTERIZER_EDGEFUNCTION_H
@@ -1,5 +1,7 @@
 #include <eigen3/Eigen/Eigen>
 #include <opencv2/opencv.hpp>
+#include <chrono>
+#include <future>
 #include <iostream>
 
 #include "Triangle.hpp"
@@ -7,6 +9,12 @@
 
 constexpr double MY_PI = 3.1415926;
 
+// milliseconds since start
+double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
 Eigen::Matrix4f get_view_matrix(Eigen::Vector3f eye_pos)
 {
 	Eigen::Matrix4f view = Eigen::Matrix4f::Identity();
@@ -76,6 +84,7 @@ int main(int argc, const char **argv)
 
 	const int WIDTH = 700, HEIGHT = 700;
 	rst::rasterizer r(WIDTH, HEIGHT);
+	r.set_packed_output(true, rst::PixelOrder::BGRA);
 
 	Eigen::Vector3f eye_pos = { 0, 0, 5 };
 
@@ -127,32 +136,43 @@ int main(int argc, const char **argv)
 		r.set_projection(get_projection_matrix(45, 1, 0.1, 50));
 
 		r.draw(pos_id, ind_id, col_id, rst::Primitive::Triangle);
-		cv::Mat image(700, 700, CV_32FC3, r.frame_buffer().data());
-		image.convertTo(image, CV_8UC3, 1.0f);
-		cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
+		cv::Mat image(700, 700, CV_8UC4, r.packed_frame_buffer().data());
 
 		cv::imwrite(filename, image);
 		return 0;
 	}
 
 
-	while (key != 27)
-	{
+	// Double buffered: frame N + 1 renders on a worker thread while frame N is shown
+	auto render = [&](float frame_angle) {
+		auto start = std::chrono::steady_clock::now();
 		r.clear(rst::Buffers::Color | rst::Buffers::Depth);
 
-		r.set_model(get_model_matrix(angle));
+		r.set_model(get_model_matrix(frame_angle));
 		r.set_view(get_view_matrix(eye_pos));
 		r.set_projection(get_projection_matrix(45, 1, 0.1, 50));
 
 		r.draw(pos_id, ind_id, col_id, rst::Primitive::Triangle);
+		return elapsed_ms(start);
+	};
+	std::vector<unsigned char> front(r.packed_frame_buffer().size());
+	std::future<double> rendering = std::async(std::launch::async, render, angle);
+
+	while (key != 27)
+	{
+		auto frame_start = std::chrono::steady_clock::now();
+		double render_ms = rendering.get();
+		std::swap(front, r.packed_frame_buffer());
+		rendering = std::async(std::launch::async, render, angle);
 
-		cv::Mat image(700, 700, CV_32FC3, r.frame_buffer().data());
-		image.convertTo(image, CV_8UC3, 1.0f);
-		cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
+		auto display_start = std::chrono::steady_clock::now();
+		cv::Mat image(700, 700, CV_8UC4, front.data());
 		cv::imshow("image", image);
 		key = cv::waitKey(10);
+		double display_ms = elapsed_ms(display_start);
 
-		std::cout << "frame count: " << frame_count++ << '\n';
+		std::cout << "frame count: " << frame_count++ << ", render " << render_ms << " ms, display " << display_ms
+			<< " ms, frame " << elapsed_ms(frame_start) << " ms\n";
 	}
 	
 	return 0;
@@ -9,8 +9,18 @@ using namespace Eigen;
 rst::rasterizer::rasterizer(int w, int h) : width(w), height(h)
 {
 	frame_buf.resize(w * h);
-	sample_buf.resize(4 * w * h);
-	depth_buf.resize(4 * w * h);
+	set_msaa(4);
+}
+
+void rst::rasterizer::set_msaa(int samples)
+{
+	if (!standard_sample_pattern(samples, pattern))
+		throw std::runtime_error("MSAA sample count must be 1, 2, 4, 8 or 16");
+	full_mask = (1u << samples) - 1;
+	pixel_color.assign(width * height, Eigen::Vector3f{ 0, 0, 1 });
+	pixel_mask.assign(width * height, (uint16_t)full_mask);
+	sample_buf.assign(samples * width * height, Eigen::Vector3f{ 0, 0, 1 });
+	depth_buf.assign(samples * width * height, std::numeric_limits<float>::infinity());
 }
 
 rst::pos_buf_id rst::rasterizer::load_positions(const std::vector<Eigen::Vector3f> &positions)
@@ -42,8 +52,18 @@ void rst::rasterizer::clear(rst::Buffers buff)
 {
 	if ((buff & rst::Buffers::Color) == rst::Buffers::Color)
 	{
-		std::fill(frame_buf.begin(), frame_buf.end(), Eigen::Vector3f{ 0, 0, 255 });
-		std::fill(sample_buf.begin(), sample_buf.end(), Eigen::Vector3f{ 0, 0, 1 });
+		if (packed)
+		{
+			for (int i = 0; i < width * height; i++)
+				pack_pixel(i, Eigen::Vector3f{ 0, 0, 255 });
+		}
+		else
+		{
+			std::fill(frame_buf.begin(), frame_buf.end(), Eigen::Vector3f{ 0, 0, 255 });
+		}
+		// sample_buf is only read for samples outside pixel_mask, so it needs no clearing
+		std::fill(pixel_color.begin(), pixel_color.end(), Eigen::Vector3f{ 0, 0, 1 });
+		std::fill(pixel_mask.begin(), pixel_mask.end(), (uint16_t)full_mask);
 	}
 	if ((buff & rst::Buffers::Depth) == rst::Buffers::Depth)
 	{
@@ -175,6 +195,63 @@ void rst::rasterizer::rasterize_triangle(const Triangle &t)
 */
 
 void rst::rasterizer::rasterize_triangle(const Triangle &t)
+{
+	if (raster_mode == RasterMode::Scalar)
+		rasterize_triangle_scalar(t);
+	else
+		rasterize_triangle_simd(t);
+}
+
+// Edge equations are set up once per triangle; coverage is then evaluated for
+// 8 pixels of a row at a time, and per-sample barycentrics come from the edge gradients.
+// Depth is tested per sample, color is interpolated once at the pixel center.
+void rst::rasterizer::rasterize_triangle_simd(const Triangle &t)
+{
+	const Vector3f *v = t.v;
+	edge_equations e;
+	if (!setup_edges(v, e))
+		return;
+
+	int min_x = max(0, (int)min(min(v[0].x(), v[1].x()), v[2].x()));
+	int max_x = min(width - 1, (int)max(max(v[0].x(), v[1].x()), v[2].x()));
+	int min_y = max(0, (int)min(min(v[0].y(), v[1].y()), v[2].y()));
+	int max_y = min(height - 1, (int)max(max(v[0].y(), v[1].y()), v[2].y()));
+
+	raster_block block;
+	for (int y = min_y; y <= max_y; y++)
+	{
+		for (int x = min_x; x <= max_x; x += 8)
+		{
+			eval_block8(e, x, y, pattern.x, pattern.y, pattern.count, block);
+			int lanes = min(8, max_x - x + 1);
+			for (int l = 0; l < lanes; l++)
+			{
+				unsigned mask = block.coverage[l];
+				if (mask == 0)
+					continue;
+				float depth[16];
+				for (int i = 0; i < pattern.count; i++)
+				{
+					if (((mask >> i) & 1u) == 0)
+						continue;
+					float dx = pattern.x[i] - 0.5f;
+					float dy = pattern.y[i] - 0.5f;
+					float alpha = block.alpha[l] + e.dbdx[0] * dx + e.dbdy[0] * dy;
+					float beta = block.beta[l] + e.dbdx[1] * dx + e.dbdy[1] * dy;
+					float gamma = block.gamma[l] + e.dbdx[2] * dx + e.dbdy[2] * dy;
+					// w is 1 for every vertex, see Triangle::toVector4
+					depth[i] = (alpha * v[0].z() + beta * v[1].z() + gamma * v[2].z()) / (alpha + beta + gamma);
+				}
+				int pix = get_index(x + l, y);
+				Vector3f color = block.alpha[l] * t.color[0] + block.beta[l] * t.color[1] + block.gamma[l] * t.color[2];
+				if (write_samples(pix, mask, depth, color))
+					set_pixel(x + l, y, resolve_pixel(pix));
+			}
+		}
+	}
+}
+
+void rst::rasterizer::rasterize_triangle_scalar(const Triangle &t)
 {
 	// TODO : Find out the bounding box of current triangle.
 	// iterate through the pixel and find if the current pixel is inside the triangle
@@ -194,53 +271,118 @@ void rst::rasterizer::rasterize_triangle(const Triangle &t)
 	{
 		for (int y = min_y; y <= max_y; y++)
 		{
-			int ind = get_index(x, y) * 4;
-			float x_offset[] = { 0.25, 0.75, 0.75, 0.25 };
-			float y_offset[] = { 0.25, 0.25, 0.75, 0.75 };
-			int num_samples = 4;
-			int cnt = 0;
-			for (int i = 0; i < 4; i++)
+			int pix = get_index(x, y);
+			unsigned mask = 0;
+			float depth[16];
+			for (int i = 0; i < pattern.count; i++)
 			{
-				if (insideTriangle(x + x_offset[i], y + y_offset[i], t.v))
+				if (insideTriangle(x + pattern.x[i], y + pattern.y[i], t.v))
 				{
 					//depth
-					auto tup = computeBarycentric2D(x + x_offset[i], y + y_offset[i], t.v);
+					auto tup = computeBarycentric2D(x + pattern.x[i], y + pattern.y[i], t.v);
 					float alpha = get<0>(tup);
 					float beta = get<1>(tup);
 					float gamma = get<2>(tup);
 					float w_reciprocal = 1.0 / (alpha / v[0].w() + beta / v[1].w() + gamma / v[2].w());
 					float z_interpolated = alpha * v[0].z() / v[0].w() + beta * v[1].z() / v[1].w() + gamma * v[2].z() / v[2].w();
 					z_interpolated *= w_reciprocal;
-					Vector3f color = alpha * t.color[0] + beta * t.color[1] + gamma * t.color[2];
-					if (z_interpolated < depth_buf[ind + i])
-					{
-						cnt++;
-						depth_buf[ind + i] = z_interpolated;
-						sample_buf[ind + i] = color;
-					}
+					depth[i] = z_interpolated;
+					mask |= 1u << i;
 				}
 			}
-			if (cnt > 0)
+			if (mask == 0)
+				continue;
+			auto tup = computeBarycentric2D(x + 0.5, y + 0.5, t.v);
+			Vector3f color = get<0>(tup) * t.color[0] + get<1>(tup) * t.color[1] + get<2>(tup) * t.color[2];
+			if (write_samples(pix, mask, depth, color))
 			{
-				Vector3f res = { 0,0,0 };
-				for (int i = 0; i < 4; i++)
-				{
-					res += sample_buf[ind + i];
-				}
-				res /= 4.0;
-				set_pixel(x, y, res);
+				set_pixel(x, y, resolve_pixel(pix));
 			}
 		}
 	}
 }
 
 
+// Depth tests the covered samples of a pixel and stores color for those that pass.
+bool rst::rasterizer::write_samples(int pix, unsigned covered, const float *depth, const Eigen::Vector3f &color)
+{
+	int base = pix * pattern.count;
+	unsigned written = 0;
+	for (int s = 0; s < pattern.count; s++)
+	{
+		if ((covered >> s) & 1u && depth[s] < depth_buf[base + s])
+		{
+			depth_buf[base + s] = depth[s];
+			written |= 1u << s;
+		}
+	}
+	if (written == 0)
+		return false;
+
+	unsigned mask = pixel_mask[pix];
+	if ((mask & ~written) == 0)
+	{
+		// every sample still using pixel_color is overwritten, so it can take the new color
+		pixel_color[pix] = color;
+		pixel_mask[pix] = (uint16_t)written;
+	}
+	else
+	{
+		for (int s = 0; s < pattern.count; s++)
+			if ((written >> s) & 1u)
+				sample_buf[base + s] = color;
+		pixel_mask[pix] = (uint16_t)(mask & ~written);
+	}
+	return true;
+}
+
+Eigen::Vector3f rst::rasterizer::resolve_pixel(int pix) const
+{
+	unsigned mask = pixel_mask[pix];
+	if (mask == full_mask)
+		return pixel_color[pix];
+	int base = pix * pattern.count;
+	Eigen::Vector3f color = (float)count_bits(mask) * pixel_color[pix];
+	for (int s = 0; s < pattern.count; s++)
+		if (!((mask >> s) & 1u))
+			color += sample_buf[base + s];
+	return color / (float)pattern.count;
+}
 
 void rst::rasterizer::set_pixel(int x, int y, const Eigen::Vector3f &color)
 {
 	if (x < 0 || x >= width || y < 0 || y >= height) return;
 
-	frame_buf[get_index(x, y)] = color * 255.0f;
+	if (packed)
+		pack_pixel(get_index(x, y), color * 255.0f);
+	else
+		frame_buf[get_index(x, y)] = color * 255.0f;
+}
+
+void rst::rasterizer::set_packed_output(bool enable, PixelOrder order)
+{
+	packed = enable;
+	red_offset = order == PixelOrder::RGBA ? 0 : 2;
+	blue_offset = 2 - red_offset;
+	packed_buf.assign(enable ? 4 * width * height : 0, 0);
+}
+
+// rounds and saturates like cv::Mat::convertTo to CV_8U
+static unsigned char to_unorm8(float v)
+{
+	v += 0.5f;
+	if (!(v > 0))
+		return 0;
+	return v >= 255 ? 255 : (unsigned char)v;
+}
+
+void rst::rasterizer::pack_pixel(int ind, const Eigen::Vector3f &color)
+{
+	unsigned char *p = &packed_buf[ind * 4];
+	p[red_offset] = to_unorm8(color.x());
+	p[1] = to_unorm8(color.y());
+	p[blue_offset] = to_unorm8(color.z());
+	p[3] = 255;
 }
 
 int rst::rasterizer::get_index(int x, int y)
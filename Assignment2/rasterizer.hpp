@@ -1,7 +1,9 @@
 #pragma once
 
 #include "Triangle.hpp"
+#include "EdgeFunction.hpp"
 #include <algorithm>
+#include <cstdint>
 #include <eigen3/Eigen/Eigen>
 
 namespace rst
@@ -28,6 +30,20 @@ namespace rst
 		Triangle
 	};
 
+	// byte order of a pixel in the packed 8-bit frame buffer
+	enum class PixelOrder
+	{
+		RGBA,
+		BGRA
+	};
+
+	// Scalar is the original per-sample insideTriangle/computeBarycentric2D loop, kept for A/B timing
+	enum class RasterMode
+	{
+		Scalar,
+		EdgeSimd
+	};
+
 	/*
 	 * For the curious : The draw function takes two buffer id's as its arguments.
 	 * These two structs make sure that if you mix up with their orders, the
@@ -59,6 +75,10 @@ namespace rst
 		void set_model(const Eigen::Matrix4f &m) { model = m; }
 		void set_view(const Eigen::Matrix4f &v) { view = v; }
 		void set_projection(const Eigen::Matrix4f &p) { projection = p; }
+		void set_raster_mode(RasterMode mode) { raster_mode = mode; }
+		// 1, 2, 4, 8 or 16 samples per pixel on the standard sample patterns; reallocates and clears the
+		// sample, depth and per-pixel resolve buffers; frame_buf and packed_buf are left as they are
+		void set_msaa(int samples);
 
 		void clear(Buffers buff);
 
@@ -67,11 +87,21 @@ namespace rst
 		int get_index(int x, int y);
 
 		std::vector<Eigen::Vector3f> &frame_buffer() { return frame_buf; }
+		// Packed mode: set_pixel rounds to 8 bits and writes straight into packed_frame_buffer(),
+		// 4 bytes per pixel in the given order with alpha 255; frame_buffer() is left untouched.
+		// The buffer can be wrapped in a CV_8UC4 cv::Mat without copying.
+		void set_packed_output(bool enable, PixelOrder order = PixelOrder::BGRA);
+		std::vector<unsigned char> &packed_frame_buffer() { return packed_buf; }
 
 	private:
+		void pack_pixel(int ind, const Eigen::Vector3f &color);
 		void draw_line(const Eigen::Vector3f &begin, const Eigen::Vector3f &end);
 		void rasterize_wireframe(const Triangle &t);
 		void rasterize_triangle(const Triangle &t);
+		void rasterize_triangle_scalar(const Triangle &t);
+		void rasterize_triangle_simd(const Triangle &t);
+		bool write_samples(int pix, unsigned covered, const float *depth, const Eigen::Vector3f &color);
+		Eigen::Vector3f resolve_pixel(int pix) const;
 		// VERTEX SHADER -> MVP -> Clipping -> /.W -> VIEWPORT -> DRAWLINE/DRAWTRI -> FRAGSHADER
 
 	private:
@@ -84,10 +114,20 @@ namespace rst
 		std::map<int, std::vector<Eigen::Vector3f>> col_buf;
 
 		std::vector<Eigen::Vector3f> frame_buf;
+		std::vector<unsigned char> packed_buf;
+		bool packed = false;
+		int red_offset = 2, blue_offset = 0;
+		// Compressed MSAA color: every sample whose bit is set in pixel_mask uses pixel_color,
+		// the others live in sample_buf. Fully covered pixels never touch sample_buf.
+		sample_pattern pattern;
+		unsigned full_mask;
+		std::vector<Eigen::Vector3f> pixel_color;
+		std::vector<uint16_t> pixel_mask;
 		std::vector<Eigen::Vector3f> sample_buf;
-		std::vector<float> depth_buf;
+		std::vector<float> depth_buf; // one depth per sample
 
 		int width, height;
+		RasterMode raster_mode = RasterMode::EdgeSimd;
 
 		int next_id = 0;
 		int get_next_id() { return next_id++; }
@@ -0,0 +1,134 @@
+#ifndef RASTERIZER_FRAMESTATS_H
+#define RASTERIZER_FRAMESTATS_H
+
+#include <atomic>
+#include <chrono>
+
+// Build with RST_ENABLE_STATS=1 to count work and time the pipeline stages. With the default of 0
+// every RST_STATS(...) statement expands to nothing and the counters stay zero.
+#ifndef RST_ENABLE_STATS
+#define RST_ENABLE_STATS 0
+#endif
+
+#if RST_ENABLE_STATS
+#define RST_STATS(...) __VA_ARGS__
+#else
+#define RST_STATS(...)
+#endif
+
+namespace rst
+{
+	enum class Stage
+	{
+		Vertex,  // vertex shader and transform
+		Setup,   // frustum rejection, clipping, viewport, culling
+		Raster,  // coverage and depth test; includes Shade and Resolve in forward shading
+		Shade,   // fragment shader
+		Resolve, // MSAA resolve
+		Count
+	};
+
+	// Counters and stage timings of one frame, from the last color clear to now.
+	// Stage times are summed over threads, so in tiled mode they can exceed wall time.
+	struct frame_stats
+	{
+		long long triangles_submitted = 0;
+		long long triangles_clipped = 0;
+		long long triangles_culled = 0;
+		long long pixels_tested = 0;
+		long long samples_tested = 0;
+		long long depth_passes = 0;
+		long long fragments_shaded = 0;
+		// hierarchical z: triangles and 8x8 blocks rejected before any coverage work,
+		// and occlusion queries issued and answered "occluded"
+		long long triangles_hiz_culled = 0;
+		long long blocks_hiz_culled = 0;
+		long long occlusion_queries = 0;
+		long long objects_occluded = 0;
+		// meshlets tested and rejected whole, before any of their triangles is set up
+		long long meshlets_tested = 0;
+		long long meshlets_frustum_culled = 0;
+		long long meshlets_backface_culled = 0;
+		double stage_ms[(int)Stage::Count] = {};
+	};
+
+	using stats_clock = std::chrono::steady_clock;
+
+	// Live counters, updated concurrently by the tiles of a frame. Hot loops count into locals
+	// and add them here once per triangle or tile.
+	struct stats_counters
+	{
+		std::atomic<long long> triangles_submitted{ 0 };
+		std::atomic<long long> triangles_clipped{ 0 };
+		std::atomic<long long> triangles_culled{ 0 };
+		std::atomic<long long> pixels_tested{ 0 };
+		std::atomic<long long> samples_tested{ 0 };
+		std::atomic<long long> depth_passes{ 0 };
+		std::atomic<long long> fragments_shaded{ 0 };
+		std::atomic<long long> triangles_hiz_culled{ 0 };
+		std::atomic<long long> blocks_hiz_culled{ 0 };
+		std::atomic<long long> occlusion_queries{ 0 };
+		std::atomic<long long> objects_occluded{ 0 };
+		std::atomic<long long> meshlets_tested{ 0 };
+		std::atomic<long long> meshlets_frustum_culled{ 0 };
+		std::atomic<long long> meshlets_backface_culled{ 0 };
+		std::atomic<long long> stage_ns[(int)Stage::Count] = {};
+
+		static void add(std::atomic<long long> &counter, long long n)
+		{
+			counter.fetch_add(n, std::memory_order_relaxed);
+		}
+
+		// adds the time from start to now to a stage and returns now
+		stats_clock::time_point add_time(Stage stage, stats_clock::time_point start)
+		{
+			stats_clock::time_point now = stats_clock::now();
+			add(stage_ns[(int)stage], std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count());
+			return now;
+		}
+
+		void reset()
+		{
+			triangles_submitted = 0;
+			triangles_clipped = 0;
+			triangles_culled = 0;
+			pixels_tested = 0;
+			samples_tested = 0;
+			depth_passes = 0;
+			fragments_shaded = 0;
+			triangles_hiz_culled = 0;
+			blocks_hiz_culled = 0;
+			occlusion_queries = 0;
+			objects_occluded = 0;
+			meshlets_tested = 0;
+			meshlets_frustum_culled = 0;
+			meshlets_backface_culled = 0;
+			for (auto &ns : stage_ns)
+				ns = 0;
+		}
+
+		frame_stats snapshot() const
+		{
+			frame_stats s;
+			s.triangles_submitted = triangles_submitted;
+			s.triangles_clipped = triangles_clipped;
+			s.triangles_culled = triangles_culled;
+			s.pixels_tested = pixels_tested;
+			s.samples_tested = samples_tested;
+			s.depth_passes = depth_passes;
+			s.fragments_shaded = fragments_shaded;
+			s.triangles_hiz_culled = triangles_hiz_culled;
+			s.blocks_hiz_culled = blocks_hiz_culled;
+			s.occlusion_queries = occlusion_queries;
+			s.objects_occluded = objects_occluded;
+			s.meshlets_tested = meshlets_tested;
+			s.meshlets_frustum_culled = meshlets_frustum_culled;
+			s.meshlets_backface_culled = meshlets_backface_culled;
+			for (int i = 0; i < (int)Stage::Count; i++)
+				s.stage_ms[i] = stage_ns[i] / 1e6;
+			return s;
+		}
+	};
+} // namespace rst
+
+#endif //RASTERIZER_FRAMESTATS_H
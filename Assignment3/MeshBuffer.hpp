@@ -0,0 +1,248 @@
+#ifndef RASTERIZER_MESHBUFFER_H
+#define RASTERIZER_MESHBUFFER_H
+
+#include <eigen3/Eigen/Eigen>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace rst
+{
+	// One attribute component for all vertices, aligned for SIMD loads.
+	using float_stream = std::vector<float, Eigen::aligned_allocator<float>>;
+
+	// Structure-of-arrays storage: the vertex stage walks x, y and z linearly.
+	struct vec3_stream
+	{
+		float_stream x, y, z;
+
+		size_t size() const { return x.size(); }
+		bool empty() const { return x.empty(); }
+		void reserve(size_t n) { x.reserve(n); y.reserve(n); z.reserve(n); }
+		void resize(size_t n) { x.resize(n); y.resize(n); z.resize(n); }
+		void push_back(float vx, float vy, float vz) { x.push_back(vx); y.push_back(vy); z.push_back(vz); }
+		void push_back(const Eigen::Vector3f &v) { push_back(v.x(), v.y(), v.z()); }
+		Eigen::Vector3f operator[](size_t i) const { return Eigen::Vector3f(x[i], y[i], z[i]); }
+	};
+
+	struct vec2_stream
+	{
+		float_stream x, y;
+
+		size_t size() const { return x.size(); }
+		bool empty() const { return x.empty(); }
+		void reserve(size_t n) { x.reserve(n); y.reserve(n); }
+		void resize(size_t n) { x.resize(n); y.resize(n); }
+		void push_back(float vx, float vy) { x.push_back(vx); y.push_back(vy); }
+		void push_back(const Eigen::Vector2f &v) { push_back(v.x(), v.y()); }
+		Eigen::Vector2f operator[](size_t i) const { return Eigen::Vector2f(x[i], y[i]); }
+	};
+
+	// A run of consecutive triangles of mesh_buffer::indices with the bounds the rasterizer culls
+	// it by: a sphere around its vertices and a cone around its triangles' winding normals.
+	struct meshlet
+	{
+		int first_index;
+		int triangle_count;
+		Eigen::Vector3f center;
+		float radius;
+		Eigen::Vector3f cone_axis;
+		float cone_cos; // cosine of the half angle, <= 0 when the cone is too wide to ever cull
+	};
+
+	// A whole indexed mesh in one place. Normals, tangents, texcoords and colors are optional
+	// and either empty or as long as positions; colors are in 0-255.
+	struct mesh_buffer
+	{
+		vec3_stream positions;
+		vec3_stream normals;
+		vec3_stream tangents; // direction of increasing u, see compute_tangents
+		vec2_stream texcoords;
+		vec3_stream colors;
+		std::vector<int> indices; // 3 per triangle
+		std::vector<meshlet> meshlets; // empty, or covering indices in order, see build_meshlets
+
+		size_t vertex_count() const { return positions.size(); }
+		size_t triangle_count() const { return indices.size() / 3; }
+
+		void reserve(size_t vertices, size_t triangles)
+		{
+			positions.reserve(vertices);
+			normals.reserve(vertices);
+			tangents.reserve(vertices);
+			texcoords.reserve(vertices);
+			colors.reserve(vertices);
+			indices.reserve(triangles * 3);
+		}
+	};
+
+	// Per-vertex tangents from the texcoord derivatives of the adjacent triangles, made
+	// orthogonal to the vertex normal. Needs normals and texcoords.
+	inline void compute_tangents(mesh_buffer &mesh)
+	{
+		size_t n = mesh.vertex_count();
+		if (mesh.normals.size() != n || mesh.texcoords.size() != n)
+			throw std::runtime_error("compute_tangents needs normals and texcoords");
+
+		std::vector<Eigen::Vector3f> sum(n, Eigen::Vector3f::Zero());
+		for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+		{
+			int a = mesh.indices[i], b = mesh.indices[i + 1], c = mesh.indices[i + 2];
+			Eigen::Vector3f e1 = mesh.positions[b] - mesh.positions[a];
+			Eigen::Vector3f e2 = mesh.positions[c] - mesh.positions[a];
+			Eigen::Vector2f d1 = mesh.texcoords[b] - mesh.texcoords[a];
+			Eigen::Vector2f d2 = mesh.texcoords[c] - mesh.texcoords[a];
+			float det = d1.x() * d2.y() - d2.x() * d1.y();
+			if (det == 0)
+				continue;
+			// dP/du, weighted by the triangle's uv area through det
+			Eigen::Vector3f t = (e1 * d2.y() - e2 * d1.y()) * (det > 0 ? 1.0f : -1.0f);
+			sum[a] += t;
+			sum[b] += t;
+			sum[c] += t;
+		}
+
+		mesh.tangents.resize(n);
+		for (size_t i = 0; i < n; i++)
+		{
+			Eigen::Vector3f normal = mesh.normals[i].normalized();
+			Eigen::Vector3f t = sum[i] - normal.dot(sum[i]) * normal;
+			// vertices without uv variation get any direction perpendicular to the normal
+			if (t.squaredNorm() < 1e-20f)
+				t = normal.unitOrthogonal();
+			t.normalize();
+			mesh.tangents.x[i] = t.x();
+			mesh.tangents.y[i] = t.y();
+			mesh.tangents.z[i] = t.z();
+		}
+	}
+
+	// Reorders the triangles into meshlets of at most max_triangles and fills mesh.meshlets. A meshlet
+	// grows breadth first over triangles sharing a vertex and only takes triangles within about 60
+	// degrees of its average normal, so it stays compact and its normal cone stays narrow. With
+	// keep_order the triangles keep their order, for indices already sorted for the vertex cache,
+	// and a meshlet is cut wherever it is full or the next triangle leaves that 60 degree range.
+	inline void build_meshlets(mesh_buffer &mesh, int max_triangles = 64, bool keep_order = false)
+	{
+		int triangles = (int)mesh.triangle_count();
+		std::vector<Eigen::Vector3f> normals(triangles);
+		for (int t = 0; t < triangles; t++)
+		{
+			const int *v = &mesh.indices[3 * t];
+			Eigen::Vector3f n = (mesh.positions[v[1]] - mesh.positions[v[0]]).cross(mesh.positions[v[2]] - mesh.positions[v[0]]);
+			float length = n.norm();
+			normals[t] = length > 0 ? Eigen::Vector3f(n / length) : Eigen::Vector3f::Zero();
+		}
+		auto fits = [&](const Eigen::Vector3f &normal_sum, int t) {
+			return normal_sum == Eigen::Vector3f::Zero() || normals[t] == Eigen::Vector3f::Zero() || normals[t].dot(normal_sum.normalized()) >= 0.5f;
+		};
+
+		std::vector<int> indices;
+		indices.reserve(mesh.indices.size());
+		std::vector<int> order; // triangles in meshlet order
+		std::vector<int> sizes; // triangles per meshlet
+		if (keep_order)
+		{
+			Eigen::Vector3f normal_sum = Eigen::Vector3f::Zero();
+			for (int t = 0; t < triangles; t++)
+			{
+				if (sizes.empty() || sizes.back() == max_triangles || !fits(normal_sum, t))
+				{
+					sizes.push_back(0);
+					normal_sum = Eigen::Vector3f::Zero();
+				}
+				order.push_back(t);
+				sizes.back()++;
+				normal_sum += normals[t];
+			}
+		}
+		else
+		{
+			// triangles around every vertex, as offsets into one array
+			std::vector<int> first(mesh.vertex_count() + 1, 0);
+			for (int i = 0; i < 3 * triangles; i++)
+				first[mesh.indices[i] + 1]++;
+			for (size_t v = 0; v < mesh.vertex_count(); v++)
+				first[v + 1] += first[v];
+			std::vector<int> around(3 * triangles);
+			std::vector<int> fill(first.begin(), first.end() - 1);
+			for (int i = 0; i < 3 * triangles; i++)
+				around[fill[mesh.indices[i]]++] = i / 3;
+
+			std::vector<bool> assigned(triangles, false);
+			std::vector<int> queue;
+			for (int seed = 0; seed < triangles; seed++)
+			{
+				if (assigned[seed])
+					continue;
+				sizes.push_back(0);
+				Eigen::Vector3f normal_sum = Eigen::Vector3f::Zero();
+				queue.assign(1, seed);
+				for (size_t q = 0; q < queue.size() && sizes.back() < max_triangles; q++)
+				{
+					int t = queue[q];
+					if (assigned[t] || !fits(normal_sum, t))
+						continue;
+					assigned[t] = true;
+					order.push_back(t);
+					sizes.back()++;
+					normal_sum += normals[t];
+					for (int k = 0; k < 3; k++)
+					{
+						int v = mesh.indices[3 * t + k];
+						for (int a = first[v]; a < first[v + 1]; a++)
+							if (!assigned[around[a]])
+								queue.push_back(around[a]);
+					}
+				}
+			}
+		}
+		for (int t : order)
+			for (int k = 0; k < 3; k++)
+				indices.push_back(mesh.indices[3 * t + k]);
+
+		mesh.meshlets.clear();
+		int first_triangle = 0;
+		for (int size : sizes)
+		{
+			meshlet m;
+			m.first_index = 3 * first_triangle;
+			m.triangle_count = size;
+			int end = 3 * (first_triangle + size);
+
+			Eigen::Vector3f lo = Eigen::Vector3f::Constant(std::numeric_limits<float>::infinity());
+			Eigen::Vector3f hi = -lo;
+			for (int i = m.first_index; i < end; i++)
+			{
+				lo = lo.cwiseMin(mesh.positions[indices[i]]);
+				hi = hi.cwiseMax(mesh.positions[indices[i]]);
+			}
+			m.center = 0.5f * (lo + hi);
+			m.radius = 0;
+			for (int i = m.first_index; i < end; i++)
+				m.radius = std::max(m.radius, (mesh.positions[indices[i]] - m.center).norm());
+
+			// degenerate triangles are never drawn, so they do not widen the cone
+			Eigen::Vector3f normal_sum = Eigen::Vector3f::Zero();
+			for (int i = first_triangle; i < first_triangle + size; i++)
+				normal_sum += normals[order[i]];
+			m.cone_axis = normal_sum.normalized();
+			m.cone_cos = normal_sum.norm() > 0 ? 1.0f : -1.0f;
+			for (int i = first_triangle; i < first_triangle + size; i++)
+				if (normals[order[i]] != Eigen::Vector3f::Zero())
+					m.cone_cos = std::min(m.cone_cos, normals[order[i]].dot(m.cone_axis));
+			mesh.meshlets.push_back(m);
+			first_triangle += size;
+		}
+		mesh.indices = std::move(indices);
+	}
+
+	// Dense handle: index into the rasterizer's mesh table.
+	struct mesh_buf_id
+	{
+		int mesh_id = 0;
+	};
+} // namespace rst
+
+#endif //RASTERIZER_MESHBUFFER_H
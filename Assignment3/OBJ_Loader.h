@@ -18,6 +18,32 @@
 #include <string>
 #include <fstream>
 #include <math.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 // Print progress to console while loading (large models)
 #define OBJL_CONSOLE_OUTPUT
@@ -217,6 +243,19 @@ namespace objl
         Material MeshMaterial;
     };
 
+    // Structure: MeshOptimizationReport
+    //
+    // Description: Average cache miss ratio (vertex shader runs per
+    //	triangle, 16 entry FIFO) and overdraw (shaded over covered
+    //	pixels, six axis views) before and after algorithm::OptimizeMesh
+    struct MeshOptimizationReport
+    {
+        float AcmrBefore;
+        float AcmrAfter;
+        float OverdrawBefore;
+        float OverdrawAfter;
+    };
+
     // Namespace: Math
     //
     // Description: The namespace that holds all of the math
@@ -406,304 +445,1015 @@ namespace objl
                 idx--;
             return elements[idx];
         }
-    }
 
-    // Class: Loader
-    //
-    // Description: The OBJ Model Loader
-    class Loader
-    {
-    public:
-        // Default Constructor
-        Loader()
+        // Merge vertices with bitwise equal position, normal and
+        //	texture coordinate, keeping the first of each in order,
+        //	and point the indices at the merged vertices
+        inline void WeldVertices(const std::vector<Vertex>& iVerts,
+                                 const std::vector<unsigned int>& iIndices,
+                                 std::vector<Vertex>& oVerts,
+                                 std::vector<unsigned int>& oIndices)
         {
+            struct Key
+            {
+                uint32_t Bits[8];
+                bool operator==(const Key& other) const
+                {
+                    return std::memcmp(Bits, other.Bits, sizeof(Bits)) == 0;
+                }
+            };
+            struct KeyHash
+            {
+                size_t operator()(const Key& key) const
+                {
+                    uint64_t h = 14695981039346656037ull;
+                    for (uint32_t bits : key.Bits)
+                        h = (h ^ bits) * 1099511628211ull;
+                    return size_t(h ^ (h >> 32));
+                }
+            };
 
+            std::unordered_map<Key, unsigned int, KeyHash> welded;
+            welded.reserve(iVerts.size());
+            std::vector<unsigned int> remap(iVerts.size());
+            oVerts.clear();
+            for (size_t i = 0; i < iVerts.size(); i++)
+            {
+                const Vertex& v = iVerts[i];
+                float values[8] = { v.Position.X, v.Position.Y, v.Position.Z,
+                                    v.Normal.X, v.Normal.Y, v.Normal.Z,
+                                    v.TextureCoordinate.X, v.TextureCoordinate.Y };
+                Key key;
+                std::memcpy(key.Bits, values, sizeof(values));
+                auto inserted = welded.insert(std::make_pair(key, (unsigned int)oVerts.size()));
+                if (inserted.second)
+                    oVerts.push_back(v);
+                remap[i] = inserted.first->second;
+            }
+
+            oIndices.resize(iIndices.size());
+            for (size_t i = 0; i < iIndices.size(); i++)
+                oIndices[i] = remap[iIndices[i]];
         }
-        ~Loader()
+
+        // Area weighted vertex normals from the triangles around
+        //	each vertex
+        inline void GenSmoothNormals(std::vector<Vertex>& ioVerts,
+                                     const std::vector<unsigned int>& iIndices)
         {
-            LoadedMeshes.clear();
+            for (auto& v : ioVerts)
+                v.Normal = Vector3(0, 0, 0);
+            for (size_t i = 0; i + 2 < iIndices.size(); i += 3)
+            {
+                Vertex& a = ioVerts[iIndices[i]];
+                Vertex& b = ioVerts[iIndices[i + 1]];
+                Vertex& c = ioVerts[iIndices[i + 2]];
+                Vector3 normal = math::CrossV3(b.Position - a.Position, c.Position - a.Position);
+                a.Normal = a.Normal + normal;
+                b.Normal = b.Normal + normal;
+                c.Normal = c.Normal + normal;
+            }
+            for (auto& v : ioVerts)
+            {
+                float length = math::MagnitudeV3(v.Normal);
+                if (length > 0)
+                    v.Normal = v.Normal / length;
+            }
         }
 
-        // Load a file into the loader
-        //
-        // If file is loaded return true
-        //
-        // If the file is unable to be found
-        // or unable to be loaded return false
-        bool LoadFile(std::string Path)
+        // Ear clip a polygon of more than 4 vertices into triangles,
+        //	as indices into iVerts in the winding of the polygon. It is
+        //	projected onto the plane of its Newell normal; only reflex
+        //	vertices can lie inside an ear, and past a few dozen vertices
+        //	they are looked up along a z-order curve, so a polygon takes
+        //	O(n log n) for the sort and a short search per ear.
+        inline void EarClipPolygon(std::vector<unsigned int>& oIndices,
+                                   const std::vector<Vertex>& iVerts)
         {
-            // If the file is not an .obj file return false
-            if (Path.substr(Path.size() - 4, 4) != ".obj")
-                return false;
-
-
-            std::ifstream file(Path);
-
-            if (!file.is_open())
-                return false;
-
-            LoadedMeshes.clear();
-            LoadedVertices.clear();
-            LoadedIndices.clear();
-
-            std::vector<Vector3> Positions;
-            std::vector<Vector2> TCoords;
-            std::vector<Vector3> Normals;
-
-            std::vector<Vertex> Vertices;
-            std::vector<unsigned int> Indices;
-
-            std::vector<std::string> MeshMatNames;
+            struct Node
+            {
+                float x, y;
+                uint32_t z;
+                int prev, next;
+                int prevZ, nextZ;
+            };
+
+            int n = int(iVerts.size());
+            Vector3 normal(0, 0, 0);
+            for (int i = 0; i < n; i++)
+            {
+                const Vector3& a = iVerts[i].Position;
+                const Vector3& b = iVerts[(i + 1) % n].Position;
+                normal.X += (a.Y - b.Y) * (a.Z + b.Z);
+                normal.Y += (a.Z - b.Z) * (a.X + b.X);
+                normal.Z += (a.X - b.X) * (a.Y + b.Y);
+            }
+            // drop the dominant axis and keep the polygon counter-clockwise
+            float ax = std::fabs(normal.X), ay = std::fabs(normal.Y), az = std::fabs(normal.Z);
+            int axis = ax >= ay && ax >= az ? 0 : (ay >= az ? 1 : 2);
+            float flip = (axis == 0 ? normal.X : axis == 1 ? normal.Y : normal.Z) < 0 ? -1.0f : 1.0f;
+
+            std::vector<Node> nodes(n);
+            float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+            for (int i = 0; i < n; i++)
+            {
+                const Vector3& p = iVerts[i].Position;
+                Node& node = nodes[i];
+                node.x = axis == 0 ? p.Y : axis == 1 ? p.Z : p.X;
+                node.y = (axis == 0 ? p.Z : axis == 1 ? p.X : p.Y) * flip;
+                node.prev = (i + n - 1) % n;
+                node.next = (i + 1) % n;
+                minX = std::min(minX, node.x);
+                minY = std::min(minY, node.y);
+                maxX = std::max(maxX, node.x);
+                maxY = std::max(maxY, node.y);
+            }
 
-            bool listening = false;
-            std::string meshname;
+            // small polygons just search every vertex
+            bool hashed = n > 32;
+            float extent = std::max(maxX - minX, maxY - minY);
+            float scale = extent > 0 ? 32767 / extent : 0;
+            auto zOrder = [&](float x, float y) {
+                if (!hashed)
+                    return uint32_t(0);
+                uint32_t ix = uint32_t((x - minX) * scale), iy = uint32_t((y - minY) * scale);
+                uint32_t z = 0;
+                for (int bit = 0; bit < 15; bit++)
+                    z |= ((ix >> bit) & 1u) << (2 * bit) | ((iy >> bit) & 1u) << (2 * bit + 1);
+                return z;
+            };
+            std::vector<int> sorted(n);
+            for (int i = 0; i < n; i++)
+            {
+                nodes[i].z = zOrder(nodes[i].x, nodes[i].y);
+                sorted[i] = i;
+            }
+            if (hashed)
+                std::sort(sorted.begin(), sorted.end(), [&](int a, int b) { return nodes[a].z < nodes[b].z; });
+            for (int i = 0; i < n; i++)
+            {
+                nodes[sorted[i]].prevZ = i > 0 ? sorted[i - 1] : -1;
+                nodes[sorted[i]].nextZ = i + 1 < n ? sorted[i + 1] : -1;
+            }
 
-            Mesh tempMesh;
+            auto area = [&](int a, int b, int c) {
+                return (nodes[b].x - nodes[a].x) * (nodes[c].y - nodes[a].y) - (nodes[b].y - nodes[a].y) * (nodes[c].x - nodes[a].x);
+            };
+            // whether vertex p is reflex and inside or on the triangle a b c
+            auto blocks = [&](int p, int a, int b, int c) {
+                return p != a && p != b && p != c
+                    && area(a, b, p) >= 0 && area(b, c, p) >= 0 && area(c, a, p) >= 0
+                    && area(nodes[p].prev, p, nodes[p].next) <= 0;
+            };
+            auto isEar = [&](int ear) {
+                int a = nodes[ear].prev, c = nodes[ear].next;
+                if (area(a, ear, c) <= 0)
+                    return false;
+                float x0 = std::min(nodes[a].x, std::min(nodes[ear].x, nodes[c].x));
+                float y0 = std::min(nodes[a].y, std::min(nodes[ear].y, nodes[c].y));
+                float x1 = std::max(nodes[a].x, std::max(nodes[ear].x, nodes[c].x));
+                float y1 = std::max(nodes[a].y, std::max(nodes[ear].y, nodes[c].y));
+                uint32_t minZ = zOrder(x0, y0), maxZ = zOrder(x1, y1);
+                for (int p = nodes[ear].nextZ; p >= 0 && nodes[p].z <= maxZ; p = nodes[p].nextZ)
+                    if (blocks(p, a, ear, c))
+                        return false;
+                for (int p = nodes[ear].prevZ; p >= 0 && nodes[p].z >= minZ; p = nodes[p].prevZ)
+                    if (blocks(p, a, ear, c))
+                        return false;
+                return true;
+            };
+            auto cut = [&](int ear) {
+                Node& node = nodes[ear];
+                oIndices.push_back(node.prev);
+                oIndices.push_back(ear);
+                oIndices.push_back(node.next);
+                nodes[node.prev].next = node.next;
+                nodes[node.next].prev = node.prev;
+                if (node.prevZ >= 0)
+                    nodes[node.prevZ].nextZ = node.nextZ;
+                if (node.nextZ >= 0)
+                    nodes[node.nextZ].prevZ = node.prevZ;
+            };
+
+            int ear = 0, stop = 0;
+            for (int remaining = n; remaining > 3;)
+            {
+                int next = nodes[ear].next;
+                if (isEar(ear))
+                {
+                    cut(ear);
+                    remaining--;
+                    ear = stop = nodes[next].next;
+                }
+                else if ((ear = next) == stop)
+                {
+                    // a whole lap without an ear: the polygon is degenerate
+                    //	or self intersecting, so cut where we are and go on
+                    next = nodes[ear].next;
+                    cut(ear);
+                    remaining--;
+                    ear = stop = next;
+                }
+            }
+            oIndices.push_back(nodes[ear].prev);
+            oIndices.push_back(ear);
+            oIndices.push_back(nodes[ear].next);
+        }
 
-#ifdef OBJL_CONSOLE_OUTPUT
-            const unsigned int outputEveryNth = 1000;
-            unsigned int outputIndicator = outputEveryNth;
-#endif
+        // Average cache miss ratio of a triangle list drawn through a
+        //	FIFO post-transform cache of cacheSize vertices
+        inline float CacheMissRatio(const std::vector<unsigned int>& iIndices,
+                                    size_t vertexCount, int cacheSize = 16)
+        {
+            if (iIndices.size() < 3)
+                return 0;
+            // number of misses when each vertex last entered the cache
+            std::vector<size_t> entered(vertexCount, 0);
+            size_t misses = 0;
+            for (unsigned int v : iIndices)
+            {
+                if (entered[v] == 0 || misses - entered[v] >= size_t(cacheSize))
+                    entered[v] = ++misses;
+            }
+            return float(misses) / float(iIndices.size() / 3);
+        }
 
-            std::string curline;
-            while (std::getline(file, curline))
+        // Shaded over covered pixels when the triangles are drawn in
+        //	order with back face culling and a depth test, looking along
+        //	each axis both ways at resolution pixels across the bounds
+        inline float OverdrawRatio(const std::vector<Vertex>& iVerts,
+                                   const std::vector<unsigned int>& iIndices,
+                                   int resolution = 256)
+        {
+            if (iVerts.empty() || iIndices.size() < 3)
+                return 0;
+            float lo[3] = { INFINITY, INFINITY, INFINITY }, hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+            for (const auto& v : iVerts)
             {
-#ifdef OBJL_CONSOLE_OUTPUT
-                if ((outputIndicator = ((outputIndicator + 1) % outputEveryNth)) == 1)
+                const float p[3] = { v.Position.X, v.Position.Y, v.Position.Z };
+                for (int k = 0; k < 3; k++)
                 {
-                    if (!meshname.empty())
+                    lo[k] = std::min(lo[k], p[k]);
+                    hi[k] = std::max(hi[k], p[k]);
+                }
+            }
+            float extent = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+            if (!(extent > 0))
+                return 0;
+
+            // triangles of a soup can each span most of the view; cap the
+            //	pixels visited by lowering the resolution instead of stalling
+            double spans = 0;
+            for (size_t i = 0; i + 2 < iIndices.size(); i += 3)
+            {
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    int u = (axis + 1) % 3, w = (axis + 2) % 3;
+                    float p[3][3];
+                    for (int k = 0; k < 3; k++)
                     {
-                        std::cout
-                                << "\r- " << meshname
-                                << "\t| vertices > " << Positions.size()
-                                << "\t| texcoords > " << TCoords.size()
-                                << "\t| normals > " << Normals.size()
-                                << "\t| triangles > " << (Vertices.size() / 3)
-                                << (!MeshMatNames.empty() ? "\t| material: " + MeshMatNames.back() : "");
+                        const Vector3& q = iVerts[iIndices[i + k]].Position;
+                        p[k][0] = q.X; p[k][1] = q.Y; p[k][2] = q.Z;
                     }
+                    float du = std::max(p[0][u], std::max(p[1][u], p[2][u])) - std::min(p[0][u], std::min(p[1][u], p[2][u]));
+                    float dw = std::max(p[0][w], std::max(p[1][w], p[2][w])) - std::min(p[0][w], std::min(p[1][w], p[2][w]));
+                    spans += double(du) * dw / (double(extent) * extent);
                 }
-#endif
-
-                // Generate a Mesh Object or Prepare for an object to be created
-                if (algorithm::firstToken(curline) == "o" || algorithm::firstToken(curline) == "g" || curline[0] == 'g')
+            }
+            const double budget = 1 << 26;
+            if (spans * resolution * resolution > budget)
+                resolution = std::max(16, int(std::sqrt(budget / spans)));
+            float scale = (resolution - 1) / extent;
+
+            std::vector<float> depth(size_t(resolution) * resolution);
+            size_t shaded = 0, covered = 0;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                int u = (axis + 1) % 3, w = (axis + 2) % 3;
+                for (float direction = -1; direction <= 1; direction += 2)
                 {
-                    if (!listening)
+                    std::fill(depth.begin(), depth.end(), INFINITY);
+                    for (size_t i = 0; i + 2 < iIndices.size(); i += 3)
                     {
-                        listening = true;
-
-                        if (algorithm::firstToken(curline) == "o" || algorithm::firstToken(curline) == "g")
+                        float x[3], y[3], z[3];
+                        for (int k = 0; k < 3; k++)
                         {
-                            meshname = algorithm::tail(curline);
+                            const Vector3& p = iVerts[iIndices[i + k]].Position;
+                            const float c[3] = { p.X, p.Y, p.Z };
+                            x[k] = (c[u] - lo[u]) * scale;
+                            y[k] = (c[w] - lo[w]) * scale;
+                            z[k] = c[axis] * direction;
                         }
-                        else
+                        // the normal along the view axis; front faces point back at the viewer
+                        float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+                        if (!(area * direction < 0))
+                            continue;
+
+                        int x0 = std::max(0, int(std::ceil(std::min(x[0], std::min(x[1], x[2])) - 0.5f)));
+                        int y0 = std::max(0, int(std::ceil(std::min(y[0], std::min(y[1], y[2])) - 0.5f)));
+                        int x1 = std::min(resolution - 1, int(std::floor(std::max(x[0], std::max(x[1], x[2])) - 0.5f)));
+                        int y1 = std::min(resolution - 1, int(std::floor(std::max(y[0], std::max(y[1], y[2])) - 0.5f)));
+                        for (int py = y0; py <= y1; py++)
                         {
-                            meshname = "unnamed";
+                            for (int px = x0; px <= x1; px++)
+                            {
+                                float sx = px + 0.5f, sy = py + 0.5f;
+                                float b0 = ((x[2] - x[1]) * (sy - y[1]) - (y[2] - y[1]) * (sx - x[1])) / area;
+                                float b1 = ((x[0] - x[2]) * (sy - y[2]) - (y[0] - y[2]) * (sx - x[2])) / area;
+                                float b2 = 1 - b0 - b1;
+                                if (b0 < 0 || b1 < 0 || b2 < 0)
+                                    continue;
+                                float d = b0 * z[0] + b1 * z[1] + b2 * z[2];
+                                float& stored = depth[size_t(py) * resolution + px];
+                                if (d < stored)
+                                {
+                                    covered += stored == INFINITY;
+                                    stored = d;
+                                    shaded++;
+                                }
+                            }
                         }
                     }
-                    else
-                    {
-                        // Generate the mesh to put into the array
-
-                        if (!Indices.empty() && !Vertices.empty())
-                        {
-                            // Create Mesh
-                            tempMesh = Mesh(Vertices, Indices);
-                            tempMesh.MeshName = meshname;
+                }
+            }
+            return covered ? float(shaded) / float(covered) : 0;
+        }
 
-                            // Insert Mesh
-                            LoadedMeshes.push_back(tempMesh);
+        // Reorder triangles ioIndices[0, indexCount) for the post-transform
+        //	vertex cache with Tipsify (Sander, Nehab and Barczak 2007):
+        //	fan around a vertex, then continue from the vertex that will
+        //	stay in cache longest. The runs between cache flushes are then
+        //	sorted so the ones facing out from the middle of the mesh come
+        //	first, where they hide the most.
+        inline void OptimizeTriangleOrder(const std::vector<Vertex>& iVerts,
+                                          unsigned int* ioIndices, size_t indexCount,
+                                          int cacheSize = 16)
+        {
+            size_t triangles = indexCount / 3;
+            size_t vertexCount = iVerts.size();
+            if (triangles < 2)
+                return;
 
-                            // Cleanup
-                            Vertices.clear();
-                            Indices.clear();
-                            meshname.clear();
+            // triangles around every vertex, as offsets into one array
+            std::vector<unsigned int> first(vertexCount + 1, 0);
+            for (size_t i = 0; i < 3 * triangles; i++)
+                first[ioIndices[i] + 1]++;
+            for (size_t v = 0; v < vertexCount; v++)
+                first[v + 1] += first[v];
+            std::vector<unsigned int> around(3 * triangles);
+            std::vector<unsigned int> fill(first.begin(), first.end() - 1);
+            for (size_t i = 0; i < 3 * triangles; i++)
+                around[fill[ioIndices[i]]++] = (unsigned int)(i / 3);
+
+            std::vector<int> live(vertexCount);
+            for (size_t v = 0; v < vertexCount; v++)
+                live[v] = int(first[v + 1] - first[v]);
+            std::vector<int> stamp(vertexCount, 0);
+            std::vector<char> emitted(triangles, 0);
+            std::vector<unsigned int> deadEnd, candidates;
+            std::vector<unsigned int> order; // triangles in output order
+            order.reserve(triangles);
+            std::vector<size_t> clusters(1, 0); // first triangle of every run
+            int time = cacheSize + 1;
+            size_t cursor = 0;
+
+            for (long fan = ioIndices[0]; fan >= 0;)
+            {
+                candidates.clear();
+                for (unsigned int a = first[fan]; a < first[fan + 1]; a++)
+                {
+                    unsigned int t = around[a];
+                    if (emitted[t])
+                        continue;
+                    emitted[t] = 1;
+                    order.push_back(t);
+                    for (int k = 0; k < 3; k++)
+                    {
+                        unsigned int v = ioIndices[3 * t + k];
+                        deadEnd.push_back(v);
+                        candidates.push_back(v);
+                        live[v]--;
+                        if (time - stamp[v] > cacheSize)
+                            stamp[v] = time++;
+                    }
+                }
 
-                            meshname = algorithm::tail(curline);
-                        }
-                        else
-                        {
-                            if (algorithm::firstToken(curline) == "o" || algorithm::firstToken(curline) == "g")
-                            {
-                                meshname = algorithm::tail(curline);
-                            }
-                            else
-                            {
-                                meshname = "unnamed";
-                            }
-                        }
+                // the candidate that stays cached while its last triangles are emitted
+                long next = -1;
+                int best = -1;
+                for (unsigned int v : candidates)
+                {
+                    if (live[v] <= 0)
+                        continue;
+                    int priority = time - stamp[v] + 2 * live[v] <= cacheSize ? time - stamp[v] : 0;
+                    if (priority > best)
+                    {
+                        best = priority;
+                        next = v;
                     }
-#ifdef OBJL_CONSOLE_OUTPUT
-                    std::cout << std::endl;
-                    outputIndicator = 0;
-#endif
                 }
-                // Generate a Vertex Position
-                if (algorithm::firstToken(curline) == "v")
+                while (next < 0 && !deadEnd.empty())
                 {
-                    std::vector<std::string> spos;
-                    Vector3 vpos;
-                    algorithm::split(algorithm::tail(curline), spos, " ");
-
-                    vpos.X = std::stof(spos[0]);
-                    vpos.Y = std::stof(spos[1]);
-                    vpos.Z = std::stof(spos[2]);
-
-                    Positions.push_back(vpos);
+                    unsigned int v = deadEnd.back();
+                    deadEnd.pop_back();
+                    if (live[v] > 0)
+                        next = v;
                 }
-                // Generate a Vertex Texture Coordinate
-                if (algorithm::firstToken(curline) == "vt")
+                for (; next < 0 && cursor < vertexCount; cursor++)
                 {
-                    std::vector<std::string> stex;
-                    Vector2 vtex;
-                    algorithm::split(algorithm::tail(curline), stex, " ");
-
-                    vtex.X = std::stof(stex[0]);
-                    vtex.Y = std::stof(stex[1]);
-
-                    TCoords.push_back(vtex);
+                    if (live[cursor] > 0)
+                        next = long(cursor);
                 }
-                // Generate a Vertex Normal;
-                if (algorithm::firstToken(curline) == "vn")
+                if (next >= 0 && time - stamp[next] > cacheSize)
+                    clusters.push_back(order.size());
+                fan = next;
+            }
+            clusters.push_back(order.size());
+
+            // outward facing runs first
+            auto triangleVertex = [&](size_t t, int k) -> const Vector3& { return iVerts[ioIndices[3 * order[t] + k]].Position; };
+            Vector3 middle(0, 0, 0);
+            for (size_t t = 0; t < triangles; t++)
+                middle = middle + (triangleVertex(t, 0) + triangleVertex(t, 1) + triangleVertex(t, 2)) / (3.0f * triangles);
+            std::vector<std::pair<float, size_t>> scores;
+            for (size_t c = 0; c + 1 < clusters.size(); c++)
+            {
+                if (clusters[c] == clusters[c + 1])
+                    continue;
+                Vector3 centroid(0, 0, 0), normal(0, 0, 0);
+                float area = 0;
+                for (size_t t = clusters[c]; t < clusters[c + 1]; t++)
                 {
-                    std::vector<std::string> snor;
-                    Vector3 vnor;
-                    algorithm::split(algorithm::tail(curline), snor, " ");
+                    Vector3 n = math::CrossV3(triangleVertex(t, 1) - triangleVertex(t, 0), triangleVertex(t, 2) - triangleVertex(t, 0));
+                    float a = math::MagnitudeV3(n);
+                    centroid = centroid + (triangleVertex(t, 0) + triangleVertex(t, 1) + triangleVertex(t, 2)) * (a / 3);
+                    normal = normal + n;
+                    area += a;
+                }
+                float length = math::MagnitudeV3(normal);
+                float score = area > 0 && length > 0 ? math::DotV3(centroid / area - middle, normal / length) : 0;
+                scores.push_back(std::make_pair(-score, c));
+            }
+            std::stable_sort(scores.begin(), scores.end(),
+                             [](const std::pair<float, size_t>& a, const std::pair<float, size_t>& b) { return a.first < b.first; });
+
+            std::vector<unsigned int> indices;
+            indices.reserve(3 * triangles);
+            for (const auto& score : scores)
+                for (size_t t = clusters[score.second]; t < clusters[score.second + 1]; t++)
+                    for (int k = 0; k < 3; k++)
+                        indices.push_back(ioIndices[3 * order[t] + k]);
+            std::copy(indices.begin(), indices.end(), ioIndices);
+        }
 
-                    vnor.X = std::stof(snor[0]);
-                    vnor.Y = std::stof(snor[1]);
-                    vnor.Z = std::stof(snor[2]);
+        // Renumber the vertices in the order the indices first use them,
+        //	so drawing fetches them front to back
+        inline void ReorderVerticesByFirstUse(std::vector<Vertex>& ioVerts,
+                                              std::vector<unsigned int>& ioIndices)
+        {
+            const unsigned int unused = ~0u;
+            std::vector<unsigned int> remap(ioVerts.size(), unused);
+            unsigned int next = 0;
+            for (unsigned int v : ioIndices)
+                if (remap[v] == unused)
+                    remap[v] = next++;
+            for (auto& r : remap)
+                if (r == unused)
+                    r = next++;
+
+            std::vector<Vertex> vertices(ioVerts.size());
+            for (size_t v = 0; v < ioVerts.size(); v++)
+                vertices[remap[v]] = ioVerts[v];
+            ioVerts.swap(vertices);
+            for (auto& v : ioIndices)
+                v = remap[v];
+        }
 
-                    Normals.push_back(vnor);
-                }
-                // Generate a Face (vertices & indices)
-                if (algorithm::firstToken(curline) == "f")
-                {
-                    // Generate the vertices
-                    std::vector<Vertex> vVerts;
-                    GenVerticesFromRawOBJ(vVerts, Positions, TCoords, Normals, curline);
+        // Reorder the triangles of every run of equal material ids for
+        //	the vertex cache and overdraw, then the vertices for fetch
+        //	order. Triangles stay within their run, so the material ids
+        //	still match.
+        inline MeshOptimizationReport OptimizeMesh(std::vector<Vertex>& ioVerts,
+                                                   std::vector<unsigned int>& ioIndices,
+                                                   const std::vector<unsigned int>& iMaterialIds)
+        {
+            MeshOptimizationReport report = {};
+            report.AcmrBefore = CacheMissRatio(ioIndices, ioVerts.size());
+            report.OverdrawBefore = OverdrawRatio(ioVerts, ioIndices);
 
-                    // Add Vertices
-                    for (int i = 0; i < int(vVerts.size()); i++)
-                    {
-                        Vertices.push_back(vVerts[i]);
+            size_t triangles = std::min(ioIndices.size() / 3, iMaterialIds.size());
+            for (size_t begin = 0, end; begin < triangles; begin = end)
+            {
+                for (end = begin + 1; end < triangles && iMaterialIds[end] == iMaterialIds[begin]; end++)
+                    ;
+                OptimizeTriangleOrder(ioVerts, ioIndices.data() + 3 * begin, 3 * (end - begin));
+            }
+            ReorderVerticesByFirstUse(ioVerts, ioIndices);
 
-                        LoadedVertices.push_back(vVerts[i]);
-                    }
+            report.AcmrAfter = CacheMissRatio(ioIndices, ioVerts.size());
+            report.OverdrawAfter = OverdrawRatio(ioVerts, ioIndices);
+            return report;
+        }
+    }
 
-                    std::vector<unsigned int> iIndices;
+    // Namespace: Parse
+    //
+    // Description: Allocation free scanning of a memory mapped
+    //	OBJ file, used by Loader::LoadFile
+    namespace parse
+    {
+        // Read-only memory mapping of a whole file
+        class MappedFile
+        {
+        public:
+            MappedFile() {}
+            ~MappedFile() { Close(); }
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
 
-                    VertexTriangluation(iIndices, vVerts);
+            bool Open(const std::string& path)
+            {
+                Close();
+#if defined(_WIN32)
+                file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+                if (file == INVALID_HANDLE_VALUE)
+                    return false;
+                LARGE_INTEGER fileSize;
+                if (!GetFileSizeEx(file, &fileSize))
+                    return false;
+                size = (size_t)fileSize.QuadPart;
+                if (size == 0)
+                    return true;
+                mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+                if (mapping == NULL)
+                    return false;
+                data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                return data != nullptr;
+#else
+                int fd = open(path.c_str(), O_RDONLY);
+                if (fd < 0)
+                    return false;
+                struct stat st;
+                bool ok = fstat(fd, &st) == 0;
+                size = ok ? (size_t)st.st_size : 0;
+                if (ok && size > 0)
+                {
+                    void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                    ok = view != MAP_FAILED;
+                    data = ok ? (const char*)view : nullptr;
+                }
+                close(fd);
+                return ok;
+#endif
+            }
 
-                    // Add Indices
-                    for (int i = 0; i < int(iIndices.size()); i++)
-                    {
-                        unsigned int indnum = (unsigned int)((Vertices.size()) - vVerts.size()) + iIndices[i];
-                        Indices.push_back(indnum);
+            void Close()
+            {
+#if defined(_WIN32)
+                if (data)
+                    UnmapViewOfFile(data);
+                if (mapping != NULL)
+                    CloseHandle(mapping);
+                if (file != INVALID_HANDLE_VALUE)
+                    CloseHandle(file);
+                mapping = NULL;
+                file = INVALID_HANDLE_VALUE;
+#else
+                if (data)
+                    munmap((void*)data, size);
+#endif
+                data = nullptr;
+                size = 0;
+            }
 
-                        indnum = (unsigned int)((LoadedVertices.size()) - vVerts.size()) + iIndices[i];
-                        LoadedIndices.push_back(indnum);
+            const char* Data() const { return data; }
+            size_t Size() const { return size; }
 
-                    }
-                }
-                // Get Mesh Material Name
-                if (algorithm::firstToken(curline) == "usemtl")
-                {
-                    MeshMatNames.push_back(algorithm::tail(curline));
+        private:
+            const char* data = nullptr;
+            size_t size = 0;
+#if defined(_WIN32)
+            HANDLE file = INVALID_HANDLE_VALUE;
+            HANDLE mapping = NULL;
+#endif
+        };
 
-                    // Create new Mesh, if Material changes within a group
-                    if (!Indices.empty() && !Vertices.empty())
-                    {
-                        // Create Mesh
-                        tempMesh = Mesh(Vertices, Indices);
-                        tempMesh.MeshName = meshname;
-                        int i = 2;
-                        while(1) {
-                            tempMesh.MeshName = meshname + "_" + std::to_string(i);
-
-                            for (auto &m : LoadedMeshes)
-                                if (m.MeshName == tempMesh.MeshName)
-                                    continue;
-                            break;
-                        }
+        inline bool isBlank(char c)
+        {
+            return c == ' ' || c == '\t';
+        }
 
-                        // Insert Mesh
-                        LoadedMeshes.push_back(tempMesh);
+        inline const char* skipBlanks(const char* p, const char* end)
+        {
+            while (p < end && isBlank(*p))
+                p++;
+            return p;
+        }
 
-                        // Cleanup
-                        Vertices.clear();
-                        Indices.clear();
-                    }
+        inline const char* skipToken(const char* p, const char* end)
+        {
+            while (p < end && !isBlank(*p))
+                p++;
+            return p;
+        }
 
-#ifdef OBJL_CONSOLE_OUTPUT
-                    outputIndicator = 0;
-#endif
+        // algorithm::tail on the line [begin, end)
+        inline std::string tail(const char* begin, const char* end)
+        {
+            const char* tailStart = skipBlanks(skipToken(skipBlanks(begin, end), end), end);
+            const char* tailEnd = end;
+            while (tailEnd > tailStart && isBlank(tailEnd[-1]))
+                tailEnd--;
+            return std::string(tailStart, tailEnd);
+        }
+
+        // std::stof on a copy of the text at p, for everything toFloat does not convert itself
+        inline float toFloatSlow(const char*& p, const char* end)
+        {
+            char buffer[128];
+            size_t n = std::min<size_t>(end - p, sizeof(buffer) - 1);
+            std::memcpy(buffer, p, n);
+            buffer[n] = 0;
+            char* stop;
+            errno = 0;
+            float value = std::strtof(buffer, &stop);
+            if (stop == buffer)
+                throw std::invalid_argument("stof");
+            if (errno == ERANGE)
+                throw std::out_of_range("stof");
+            p += stop - buffer;
+            return value;
+        }
+
+        // Parses the number at p like std::stof and moves p past it. Up
+        //	to 15 significant digits with a decimal exponent within 22 are
+        //	exact in double, so a single rounding to float gives the
+        //	correctly rounded result unless the double lies exactly half
+        //	way between two floats; those and all other forms go to strtof.
+        inline float toFloat(const char*& p, const char* end)
+        {
+            static const double powers[] = {
+                1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+            };
+            const char* s = p;
+            bool negative = false;
+            if (s < end && (*s == '+' || *s == '-'))
+                negative = *s++ == '-';
+            uint64_t mantissa = 0;
+            int digits = 0, exponent = 0;
+            const char* digitsStart = s;
+            for (; s < end && *s >= '0' && *s <= '9'; s++)
+            {
+                mantissa = mantissa * 10 + (*s - '0');
+                digits += mantissa != 0;
+            }
+            bool anyDigits = s != digitsStart;
+            if (s < end && *s == '.')
+            {
+                const char* fractionStart = ++s;
+                for (; s < end && *s >= '0' && *s <= '9'; s++)
+                {
+                    mantissa = mantissa * 10 + (*s - '0');
+                    digits += mantissa != 0;
+                    exponent--;
                 }
-                // Load Materials
-                if (algorithm::firstToken(curline) == "mtllib")
+                anyDigits = anyDigits || s != fractionStart;
+            }
+            if (!anyDigits || digits > 15)
+                return toFloatSlow(p, end);
+            if (s < end && (*s == 'e' || *s == 'E'))
+            {
+                const char* e = s + 1;
+                bool negativeExponent = false;
+                if (e < end && (*e == '+' || *e == '-'))
+                    negativeExponent = *e++ == '-';
+                if (e < end && *e >= '0' && *e <= '9')
                 {
-                    // Generate LoadedMaterial
-
-                    // Generate a path to the material file
-                    std::vector<std::string> temp;
-                    algorithm::split(Path, temp, "/");
+                    int value = 0;
+                    for (; e < end && *e >= '0' && *e <= '9'; e++)
+                        value = std::min(value * 10 + (*e - '0'), 1000);
+                    exponent += negativeExponent ? -value : value;
+                    s = e;
+                }
+            }
+            // hex floats, inf, nan and anything glued to the number
+            if (s < end && !isBlank(*s) && *s != '\r' && *s != '\n')
+                return toFloatSlow(p, end);
+            if (exponent < -22 || exponent > 22)
+                return toFloatSlow(p, end);
+
+            double value = exponent < 0 ? mantissa / powers[-exponent] : mantissa * powers[exponent];
+            float result = (float)value;
+            if ((double)result != value)
+            {
+                float other = std::nextafter(result, value > result ? HUGE_VALF : -HUGE_VALF);
+                if (value == ((double)result + (double)other) / 2)
+                    return toFloatSlow(p, end);
+            }
+            p = s;
+            return negative ? -result : result;
+        }
 
-                    std::string pathtomat = "";
+        // Parses the integer at p like std::stoi and moves p past it
+        inline int toInt(const char*& p, const char* end)
+        {
+            const char* s = p;
+            bool negative = false;
+            if (s < end && (*s == '+' || *s == '-'))
+                negative = *s++ == '-';
+            const char* digitsStart = s;
+            long long value = 0;
+            for (; s < end && *s >= '0' && *s <= '9'; s++)
+            {
+                value = value * 10 + (*s - '0');
+                if (value > (long long)INT_MAX + 1)
+                    throw std::out_of_range("stoi");
+            }
+            if (s == digitsStart)
+                throw std::invalid_argument("stoi");
+            value = negative ? -value : value;
+            if (value > INT_MAX)
+                throw std::out_of_range("stoi");
+            p = s;
+            return (int)value;
+        }
 
-                    if (temp.size() != 1)
+        // Runs fn(0), ..., fn(count - 1) on their own threads, fn(0) on
+        //	the calling one, and rethrows the first exception
+        template <class Fn>
+        void parallelFor(size_t count, const Fn& fn)
+        {
+            std::vector<std::exception_ptr> errors(count);
+            std::vector<std::thread> threads;
+            for (size_t i = 1; i < count; i++)
+            {
+                threads.emplace_back([&fn, &errors, i]() {
+                    try
                     {
-                        for (int i = 0; i < temp.size() - 1; i++)
-                        {
-                            pathtomat += temp[i] + "/";
-                        }
+                        fn(i);
                     }
+                    catch (...)
+                    {
+                        errors[i] = std::current_exception();
+                    }
+                });
+            }
+            try
+            {
+                if (count > 0)
+                    fn(0);
+            }
+            catch (...)
+            {
+                errors[0] = std::current_exception();
+            }
+            for (auto& t : threads)
+                t.join();
+            for (auto& e : errors)
+                if (e)
+                    std::rethrow_exception(e);
+        }
 
+        // 64 bit hash of a whole file, to tell whether a cache built
+        //	from it is still current
+        inline uint64_t hashBytes(const char* data, size_t size)
+        {
+            uint64_t h = 14695981039346656037ull ^ size;
+            size_t i = 0;
+            for (; i + 8 <= size; i += 8)
+            {
+                uint64_t word;
+                std::memcpy(&word, data + i, 8);
+                h = (h ^ word) * 1099511628211ull;
+                h ^= h >> 32;
+            }
+            for (; i < size; i++)
+                h = (h ^ (unsigned char)data[i]) * 1099511628211ull;
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdull;
+            h ^= h >> 33;
+            return h;
+        }
 
-                    pathtomat += algorithm::tail(curline);
+        // A face as written: 4 entries per corner in Corners, and the
+        //	attribute counts of its chunk before it, for negative indices
+        struct Face
+        {
+            unsigned int FirstCorner;
+            unsigned int CornerCount;
+            unsigned int PositionsBefore;
+            unsigned int TCoordsBefore;
+            unsigned int NormalsBefore;
+            // triangulated indices, filled in by BuildChunk
+            unsigned int IndexCount;
+        };
+
+        enum class Statement
+        {
+            Group,
+            UseMaterial,
+            MaterialLibrary
+        };
 
-#ifdef OBJL_CONSOLE_OUTPUT
-                    std::cout << std::endl << "- find materials in: " << pathtomat << std::endl;
-#endif
+        // An o/g, usemtl or mtllib line and the number of faces before it in its chunk
+        struct Event
+        {
+            Statement Kind;
+            bool Named; // o or g as the first token, rather than a line starting with g
+            std::string Tail;
+            size_t FacesBefore;
+        };
+
+        // Everything parsed from one line aligned chunk of the file
+        struct Chunk
+        {
+            std::vector<Vector3> Positions;
+            std::vector<Vector2> TCoords;
+            std::vector<Vector3> Normals;
+            std::vector<Face> Faces;
+            // vertex type (1 P, 2 P/T, 3 P//N, 4 P/T/N) and the three indices as written
+            std::vector<int> Corners;
+            std::vector<Event> Events;
+            // one per corner and the face local triangle indices, in face order
+            std::vector<Vertex> Vertices;
+            std::vector<unsigned int> Indices;
+            size_t PositionBase = 0, TCoordBase = 0, NormalBase = 0;
+        };
+    }
 
-                    // Load Materials
-                    LoadMaterials(pathtomat);
-                }
-            }
+    // Class: Loader
+    //
+    // Description: The OBJ Model Loader
+    class Loader
+    {
+    public:
+        // Default Constructor
+        Loader()
+        {
 
-#ifdef OBJL_CONSOLE_OUTPUT
-            std::cout << std::endl;
-#endif
+        }
+        ~Loader()
+        {
+            LoadedMeshes.clear();
+        }
 
-            // Deal with last mesh
+        // Load a file into the loader
+        //
+        // If file is loaded return true
+        //
+        // If the file is unable to be found
+        // or unable to be loaded return false
+        //
+        // The file is memory mapped and cut into line aligned chunks
+        //	that are parsed on their own threads; the meshes, vertices,
+        //	indices and materials are the same a line by line
+        //	parse of the file gives
+        bool LoadFile(std::string Path)
+        {
+            // If the file is not an .obj file return false
+            if (Path.size() < 4 || Path.substr(Path.size() - 4, 4) != ".obj")
+                return false;
 
-            if (!Indices.empty() && !Vertices.empty())
+            parse::MappedFile file;
+            if (!file.Open(Path))
+                return false;
+
+            LoadedMeshes.clear();
+            LoadedVertices.clear();
+            LoadedIndices.clear();
+
+            // Cut the file after a newline roughly every megabyte,
+            //	at most one chunk per hardware thread
+            const char* data = file.Data();
+            size_t size = file.Size();
+            size_t threads = std::max(1u, std::thread::hardware_concurrency());
+            size_t chunkCount = std::max<size_t>(1, std::min(threads, size >> 20));
+            std::vector<const char*> cuts(1, data);
+            for (size_t i = 1; i < chunkCount; i++)
             {
-                // Create Mesh
-                tempMesh = Mesh(Vertices, Indices);
-                tempMesh.MeshName = meshname;
+                const char* cut = std::max(data + size * i / chunkCount, cuts.back());
+                const char* newline = (const char*)std::memchr(cut, '\n', data + size - cut);
+                if (newline)
+                    cuts.push_back(newline + 1);
+            }
+            cuts.push_back(data + size);
+            std::vector<parse::Chunk> chunks(cuts.size() - 1);
+
+            parse::parallelFor(chunks.size(), [&](size_t i) {
+                ParseChunk(chunks[i], cuts[i], cuts[i + 1]);
+            });
 
-                // Insert Mesh
-                LoadedMeshes.push_back(tempMesh);
+            // Join the attributes; faces index them globally
+            std::vector<Vector3> Positions;
+            std::vector<Vector2> TCoords;
+            std::vector<Vector3> Normals;
+            for (auto& chunk : chunks)
+            {
+                chunk.PositionBase = Positions.size();
+                chunk.TCoordBase = TCoords.size();
+                chunk.NormalBase = Normals.size();
+                Positions.insert(Positions.end(), chunk.Positions.begin(), chunk.Positions.end());
+                TCoords.insert(TCoords.end(), chunk.TCoords.begin(), chunk.TCoords.end());
+                Normals.insert(Normals.end(), chunk.Normals.begin(), chunk.Normals.end());
             }
 
-            file.close();
+            parse::parallelFor(chunks.size(), [&](size_t i) {
+                BuildChunk(chunks[i], Positions, TCoords, Normals);
+            });
 
-            // Set Materials for each Mesh
-            for (int i = 0; i < MeshMatNames.size(); i++)
+            size_t vertexCount = 0, indexCount = 0;
+            for (auto& chunk : chunks)
             {
-                std::string matname = MeshMatNames[i];
+                vertexCount += chunk.Vertices.size();
+                indexCount += chunk.Indices.size();
+            }
+            LoadedVertices.reserve(vertexCount);
+            LoadedIndices.reserve(indexCount);
 
-                // Find corresponding material name in loaded materials
-                // when found copy material variables into mesh material
-                for (int j = 0; j < LoadedMaterials.size(); j++)
+            // Replay the faces and statements in file order
+            std::vector<Vertex> Vertices;
+            std::vector<unsigned int> Indices;
+
+            std::vector<std::string> MeshMatNames;
+
+            bool listening = false;
+            std::string meshname;
+
+            for (auto& chunk : chunks)
+            {
+                size_t face = 0, vertex = 0, index = 0;
+                size_t event = 0;
+                while (face < chunk.Faces.size() || event < chunk.Events.size())
                 {
-                    if (LoadedMaterials[j].name == matname)
+                    if (event < chunk.Events.size() && chunk.Events[event].FacesBefore == face)
                     {
-                        LoadedMeshes[i].MeshMaterial = LoadedMaterials[j];
-                        break;
+                        const parse::Event& e = chunk.Events[event++];
+                        if (e.Kind == parse::Statement::Group)
+                        {
+                            if (!listening)
+                            {
+                                listening = true;
+                                meshname = e.Named ? e.Tail : "unnamed";
+                            }
+                            else if (!Indices.empty() && !Vertices.empty())
+                            {
+                                PushMesh(Vertices, Indices, meshname);
+                                meshname = e.Tail;
+                            }
+                            else
+                            {
+                                meshname = e.Named ? e.Tail : "unnamed";
+                            }
+                        }
+                        else if (e.Kind == parse::Statement::UseMaterial)
+                        {
+                            MeshMatNames.push_back(e.Tail);
+
+                            // Create new Mesh, if Material changes within a group
+                            if (!Indices.empty() && !Vertices.empty())
+                                PushMesh(Vertices, Indices, meshname + "_2");
+                        }
+                        else
+                        {
+                            LoadMaterials(MaterialPath(Path, e.Tail));
+                        }
+                        continue;
+                    }
+
+                    const parse::Face& f = chunk.Faces[face++];
+                    unsigned int meshBase = (unsigned int)Vertices.size();
+                    unsigned int loadedBase = (unsigned int)LoadedVertices.size();
+                    Vertices.insert(Vertices.end(), chunk.Vertices.begin() + vertex, chunk.Vertices.begin() + vertex + f.CornerCount);
+                    LoadedVertices.insert(LoadedVertices.end(), chunk.Vertices.begin() + vertex, chunk.Vertices.begin() + vertex + f.CornerCount);
+                    for (unsigned int i = 0; i < f.IndexCount; i++)
+                    {
+                        Indices.push_back(meshBase + chunk.Indices[index + i]);
+                        LoadedIndices.push_back(loadedBase + chunk.Indices[index + i]);
                     }
+                    vertex += f.CornerCount;
+                    index += f.IndexCount;
                 }
+                // release each chunk as soon as it is copied out
+                chunk = parse::Chunk();
             }
 
+            // Deal with last mesh
+            if (!Indices.empty() && !Vertices.empty())
+                PushMesh(Vertices, Indices, meshname);
+
+#ifdef OBJL_CONSOLE_OUTPUT
+            std::cout << "- " << Path
+                      << "\t| vertices > " << Positions.size()
+                      << "\t| texcoords > " << TCoords.size()
+                      << "\t| normals > " << Normals.size()
+                      << "\t| triangles > " << (LoadedIndices.size() / 3)
+                      << "\t| meshes > " << LoadedMeshes.size() << std::endl;
+#endif
+
+            SetMeshMaterials(MeshMatNames);
+            LoadedNormals = !Normals.empty();
+
             if (LoadedMeshes.empty() && LoadedVertices.empty() && LoadedIndices.empty())
             {
                 return false;
@@ -722,123 +1472,284 @@ namespace objl
         std::vector<unsigned int> LoadedIndices;
         // Loaded Material Objects
         std::vector<Material> LoadedMaterials;
+        // Whether the file had vertex normals; without them every
+        //	vertex has the normal of its face
+        bool LoadedNormals = false;
+        // Triangulate with the original ear clipping instead of the
+        //	fast paths, to compare against
+        bool ReferenceTriangulation = false;
 
     private:
-        // Generate vertices from a list of positions,
-        //	tcoords, normals and a face line
-        void GenVerticesFromRawOBJ(std::vector<Vertex>& oVerts,
-                                   const std::vector<Vector3>& iPositions,
-                                   const std::vector<Vector2>& iTCoords,
-                                   const std::vector<Vector3>& iNormals,
-                                   std::string icurline)
-        {
-            std::vector<std::string> sface, svert;
-            Vertex vVert;
-            algorithm::split(algorithm::tail(icurline), sface, " ");
-
-            bool noNormal = false;
-
-            // For every given vertex do this
-            for (int i = 0; i < int(sface.size()); i++)
-            {
-                // See What type the vertex is.
-                int vtype;
+        // Insert a mesh made of the current vertices and indices
+        //	and start a new one
+        void PushMesh(std::vector<Vertex>& Vertices, std::vector<unsigned int>& Indices, const std::string& name)
+        {
+            Mesh tempMesh(Vertices, Indices);
+            tempMesh.MeshName = name;
+            LoadedMeshes.push_back(tempMesh);
 
-                algorithm::split(sface[i], svert, "/");
+            Vertices.clear();
+            Indices.clear();
+        }
 
-                // Check for just position - v1
-                if (svert.size() == 1)
-                {
-                    // Only position
-                    vtype = 1;
-                }
+        // Path to a material library named in an OBJ file,
+        //	relative to the directory of that file
+        std::string MaterialPath(const std::string& Path, const std::string& name)
+        {
+            std::vector<std::string> temp;
+            algorithm::split(Path, temp, "/");
+
+            std::string pathtomat = "";
 
-                // Check for position & texture - v1/vt1
-                if (svert.size() == 2)
+            if (temp.size() != 1)
+            {
+                for (int i = 0; i < int(temp.size()) - 1; i++)
                 {
-                    // Position & Texture
-                    vtype = 2;
+                    pathtomat += temp[i] + "/";
                 }
+            }
 
-                // Check for Position, Texture and Normal - v1/vt1/vn1
-                // or if Position and Normal - v1//vn1
-                if (svert.size() == 3)
+            pathtomat += name;
+
+#ifdef OBJL_CONSOLE_OUTPUT
+            std::cout << std::endl << "- find materials in: " << pathtomat << std::endl;
+#endif
+            return pathtomat;
+        }
+
+        // Give the i-th mesh the material of the i-th usemtl
+        void SetMeshMaterials(const std::vector<std::string>& MeshMatNames)
+        {
+            for (size_t i = 0; i < MeshMatNames.size() && i < LoadedMeshes.size(); i++)
+            {
+                for (size_t j = 0; j < LoadedMaterials.size(); j++)
                 {
-                    if (svert[1] != "")
+                    if (LoadedMaterials[j].name == MeshMatNames[i])
                     {
-                        // Position, Texture, and Normal
-                        vtype = 4;
-                    }
-                    else
-                    {
-                        // Position & Normal
-                        vtype = 3;
+                        LoadedMeshes[i].MeshMaterial = LoadedMaterials[j];
+                        break;
                     }
                 }
+            }
+        }
+
+        // First pass over a chunk: attributes, raw faces and the
+        //	statements that split meshes, nothing resolved yet
+        void ParseChunk(parse::Chunk& chunk, const char* begin, const char* end)
+        {
+            // a face line is usually a few times longer than a vertex line
+            size_t guess = (end - begin) / 40;
+            chunk.Positions.reserve(guess);
+            chunk.Faces.reserve(guess);
+            chunk.Corners.reserve(guess * 12);
+
+            for (const char* line = begin; line < end;)
+            {
+                const char* lineEnd = (const char*)std::memchr(line, '\n', end - line);
+                if (!lineEnd)
+                    lineEnd = end;
+                const char* next = lineEnd < end ? lineEnd + 1 : end;
+
+                const char* token = parse::skipBlanks(line, lineEnd);
+                const char* p = parse::skipToken(token, lineEnd);
+                size_t length = p - token;
+                p = parse::skipBlanks(p, lineEnd);
 
-                // Calculate and store the vertex
-                switch (vtype)
+                if (length == 1 && token[0] == 'v')
                 {
-                    case 1: // P
-                    {
-                        vVert.Position = algorithm::getElement(iPositions, svert[0]);
-                        vVert.TextureCoordinate = Vector2(0, 0);
-                        noNormal = true;
-                        oVerts.push_back(vVert);
-                        break;
-                    }
-                    case 2: // P/T
-                    {
-                        vVert.Position = algorithm::getElement(iPositions, svert[0]);
-                        vVert.TextureCoordinate = algorithm::getElement(iTCoords, svert[1]);
-                        noNormal = true;
-                        oVerts.push_back(vVert);
-                        break;
-                    }
-                    case 3: // P//N
-                    {
-                        vVert.Position = algorithm::getElement(iPositions, svert[0]);
-                        vVert.TextureCoordinate = Vector2(0, 0);
-                        vVert.Normal = algorithm::getElement(iNormals, svert[2]);
-                        oVerts.push_back(vVert);
-                        break;
-                    }
-                    case 4: // P/T/N
-                    {
-                        vVert.Position = algorithm::getElement(iPositions, svert[0]);
-                        vVert.TextureCoordinate = algorithm::getElement(iTCoords, svert[1]);
-                        vVert.Normal = algorithm::getElement(iNormals, svert[2]);
-                        oVerts.push_back(vVert);
-                        break;
-                    }
-                    default:
+                    Vector3 vpos;
+                    vpos.X = parse::toFloat(p, lineEnd);
+                    vpos.Y = parse::toFloat(p = parse::skipBlanks(p, lineEnd), lineEnd);
+                    vpos.Z = parse::toFloat(p = parse::skipBlanks(p, lineEnd), lineEnd);
+                    chunk.Positions.push_back(vpos);
+                }
+                else if (length == 2 && token[0] == 'v' && token[1] == 't')
+                {
+                    Vector2 vtex;
+                    vtex.X = parse::toFloat(p, lineEnd);
+                    vtex.Y = parse::toFloat(p = parse::skipBlanks(p, lineEnd), lineEnd);
+                    chunk.TCoords.push_back(vtex);
+                }
+                else if (length == 2 && token[0] == 'v' && token[1] == 'n')
+                {
+                    Vector3 vnor;
+                    vnor.X = parse::toFloat(p, lineEnd);
+                    vnor.Y = parse::toFloat(p = parse::skipBlanks(p, lineEnd), lineEnd);
+                    vnor.Z = parse::toFloat(p = parse::skipBlanks(p, lineEnd), lineEnd);
+                    chunk.Normals.push_back(vnor);
+                }
+                else if (length == 1 && token[0] == 'f')
+                {
+                    parse::Face face;
+                    face.FirstCorner = (unsigned int)chunk.Corners.size();
+                    face.PositionsBefore = (unsigned int)chunk.Positions.size();
+                    face.TCoordsBefore = (unsigned int)chunk.TCoords.size();
+                    face.NormalsBefore = (unsigned int)chunk.Normals.size();
+                    face.IndexCount = 0;
+                    for (p = parse::skipBlanks(p, lineEnd); p < lineEnd; p = parse::skipBlanks(p, lineEnd))
                     {
-                        break;
+                        const char* cornerEnd = parse::skipToken(p, lineEnd);
+                        // P, P/T, P//N or P/T/N
+                        int vtype = 1, t = 0, n = 0;
+                        int v = parse::toInt(p, cornerEnd);
+                        if (p + 1 < cornerEnd && p[0] == '/')
+                        {
+                            if (p[1] == '/')
+                            {
+                                p += 2;
+                                n = parse::toInt(p, cornerEnd);
+                                vtype = 3;
+                            }
+                            else
+                            {
+                                p++;
+                                t = parse::toInt(p, cornerEnd);
+                                vtype = 2;
+                                if (p + 1 < cornerEnd && p[0] == '/')
+                                {
+                                    p++;
+                                    n = parse::toInt(p, cornerEnd);
+                                    vtype = 4;
+                                }
+                            }
+                        }
+                        chunk.Corners.push_back(vtype);
+                        chunk.Corners.push_back(v);
+                        chunk.Corners.push_back(t);
+                        chunk.Corners.push_back(n);
+                        p = cornerEnd;
                     }
+                    face.CornerCount = (unsigned int)(chunk.Corners.size() - face.FirstCorner) / 4;
+                    chunk.Faces.push_back(face);
+                }
+                else if ((length == 1 && (token[0] == 'o' || token[0] == 'g')) || (line < lineEnd && line[0] == 'g'))
+                {
+                    bool named = length == 1 && (token[0] == 'o' || token[0] == 'g');
+                    chunk.Events.push_back({ parse::Statement::Group, named, parse::tail(line, lineEnd), chunk.Faces.size() });
+                }
+                else if (length == 6 && std::memcmp(token, "usemtl", 6) == 0)
+                {
+                    chunk.Events.push_back({ parse::Statement::UseMaterial, false, parse::tail(line, lineEnd), chunk.Faces.size() });
+                }
+                else if (length == 6 && std::memcmp(token, "mtllib", 6) == 0)
+                {
+                    chunk.Events.push_back({ parse::Statement::MaterialLibrary, false, parse::tail(line, lineEnd), chunk.Faces.size() });
                 }
+                line = next;
             }
+        }
 
-            // take care of missing normals
-            // these may not be truly acurate but it is the
-            // best they get for not compiling a mesh with normals
-            if (noNormal)
+        // Second pass over a chunk, once the attributes of all chunks
+        //	are joined: resolve and triangulate its faces
+        void BuildChunk(parse::Chunk& chunk,
+                        const std::vector<Vector3>& iPositions,
+                        const std::vector<Vector2>& iTCoords,
+                        const std::vector<Vector3>& iNormals)
+        {
+            std::vector<Vertex> vVerts;
+            std::vector<unsigned int> iIndices;
+            chunk.Vertices.reserve(chunk.Corners.size() / 4);
+            chunk.Indices.reserve(chunk.Corners.size() / 4 * 3);
+            // a negative index counts back from the attributes read before the face
+            auto element = [](const auto& elements, int idx, size_t before) -> const auto& {
+                size_t i = idx < 0 ? before + idx : size_t(idx) - 1;
+                if (idx == 0 || i >= elements.size())
+                    throw std::out_of_range("OBJ face index");
+                return elements[i];
+            };
+            for (auto& face : chunk.Faces)
             {
-                Vector3 A = oVerts[0].Position - oVerts[1].Position;
-                Vector3 B = oVerts[2].Position - oVerts[1].Position;
-
-                Vector3 normal = math::CrossV3(A, B);
+                size_t positionsBefore = chunk.PositionBase + face.PositionsBefore;
+                size_t tcoordsBefore = chunk.TCoordBase + face.TCoordsBefore;
+                size_t normalsBefore = chunk.NormalBase + face.NormalsBefore;
+
+                vVerts.clear();
+                Vertex vVert;
+                bool noNormal = false;
+                for (unsigned int c = 0; c < face.CornerCount; c++)
+                {
+                    const int* corner = &chunk.Corners[face.FirstCorner + 4 * c];
+                    vVert.Position = element(iPositions, corner[1], positionsBefore);
+                    vVert.TextureCoordinate = corner[0] == 2 || corner[0] == 4 ? element(iTCoords, corner[2], tcoordsBefore) : Vector2(0, 0);
+                    if (corner[0] == 3 || corner[0] == 4)
+                        vVert.Normal = element(iNormals, corner[3], normalsBefore);
+                    else
+                        noNormal = true;
+                    vVerts.push_back(vVert);
+                }
 
-                for (int i = 0; i < int(oVerts.size()); i++)
+                // take care of missing normals
+                if (noNormal && vVerts.size() >= 3)
                 {
-                    oVerts[i].Normal = normal;
+                    Vector3 A = vVerts[0].Position - vVerts[1].Position;
+                    Vector3 B = vVerts[2].Position - vVerts[1].Position;
+
+                    Vector3 normal = math::CrossV3(A, B);
+
+                    for (auto& v : vVerts)
+                        v.Normal = normal;
                 }
+
+                iIndices.clear();
+                VertexTriangluation(iIndices, vVerts);
+
+                chunk.Vertices.insert(chunk.Vertices.end(), vVerts.begin(), vVerts.end());
+                chunk.Indices.insert(chunk.Indices.end(), iIndices.begin(), iIndices.end());
+                face.IndexCount = (unsigned int)iIndices.size();
             }
         }
 
         // Triangulate a list of vertices into a face by printing
         //	inducies corresponding with triangles within it
+        //
+        // Triangles and quads take constant time: a quad is split
+        //	along the diagonal through its reflex vertex, if it has one,
+        //	else from vertex 1 to 3 as the reference does. Larger
+        //	polygons go to algorithm::EarClipPolygon.
         void VertexTriangluation(std::vector<unsigned int>& oIndices,
                                  const std::vector<Vertex>& iVerts)
+        {
+            if (ReferenceTriangulation)
+            {
+                VertexTriangluationReference(oIndices, iVerts);
+                return;
+            }
+
+            if (iVerts.size() < 3)
+                return;
+
+            if (iVerts.size() == 3)
+            {
+                oIndices.push_back(0);
+                oIndices.push_back(1);
+                oIndices.push_back(2);
+                return;
+            }
+
+            if (iVerts.size() == 4)
+            {
+                const Vector3& p0 = iVerts[0].Position;
+                const Vector3& p1 = iVerts[1].Position;
+                const Vector3& p2 = iVerts[2].Position;
+                const Vector3& p3 = iVerts[3].Position;
+                Vector3 normal = math::CrossV3(p2 - p0, p3 - p1);
+                bool reflex0 = math::DotV3(math::CrossV3(p0 - p3, p1 - p0), normal) < 0;
+                bool reflex2 = math::DotV3(math::CrossV3(p2 - p1, p3 - p2), normal) < 0;
+                const unsigned int split13[] = { 0, 1, 3, 1, 2, 3 };
+                const unsigned int split02[] = { 0, 1, 2, 0, 2, 3 };
+                const unsigned int* split = reflex0 || reflex2 ? split02 : split13;
+                oIndices.insert(oIndices.end(), split, split + 6);
+                return;
+            }
+
+            algorithm::EarClipPolygon(oIndices, iVerts);
+        }
+
+        // The original triangulation: ear clipping that finds
+        //	vertices by position, quadratic or worse in the vertex
+        //	count, kept for ReferenceTriangulation
+        void VertexTriangluationReference(std::vector<unsigned int>& oIndices,
+                                          const std::vector<Vertex>& iVerts)
         {
             // If there are 2 or less verts,
             // no triangle can be created,
@@ -1166,5 +2077,315 @@ namespace objl
                 return true;
         }
     };
+
+    // Structure: MeshCacheHeader
+    //
+    // Description: Start of a binary mesh cache file; the array
+    //	offsets are from the start of the file and 16 byte aligned
+    struct MeshCacheHeader
+    {
+        char Magic[8];
+        uint32_t Version;
+        uint32_t MeshCount;
+        // hash of the OBJ file the cache was built from
+        uint64_t SourceHash;
+        uint64_t FileSize;
+        uint32_t VertexCount;
+        uint32_t IndexCount;
+        uint32_t MaterialCount;
+        // whether the triangles and vertices went through algorithm::OptimizeMesh
+        uint32_t Optimized;
+        MeshOptimizationReport Optimization;
+        float BoundsMin[3];
+        float BoundsMax[3];
+        uint64_t PositionsOffset;
+        uint64_t NormalsOffset;
+        uint64_t TextureCoordinatesOffset;
+        uint64_t IndicesOffset;
+        // one per triangle, into the material names
+        uint64_t MaterialIdsOffset;
+        // MaterialCount null terminated names
+        uint64_t MaterialNamesOffset;
+    };
+
+    // Class: MeshCache
+    //
+    // Description: The welded vertices and indices of an OBJ file as
+    //	flat arrays, read in place from a memory mapped binary cache next
+    //	to it. The cache is written the first time the OBJ is loaded
+    //	and again whenever the hash of the OBJ contents changes.
+    class MeshCache
+    {
+    public:
+        // Load the cache of an .obj file, parsing the OBJ with
+        //	Loader and writing the cache first if it is missing
+        //	or out of date. With Optimize the cached mesh is reordered
+        //	by algorithm::OptimizeMesh; a cache built the other way is
+        //	rebuilt.
+        //
+        // If the OBJ is unable to be loaded return false
+        bool LoadFile(const std::string& Path, bool Optimize = false)
+        {
+            Close();
+
+            parse::MappedFile source;
+            if (!source.Open(Path))
+                return false;
+            uint64_t hash = parse::hashBytes(source.Data(), source.Size());
+            std::string cachePath = Path + ".cache";
+
+            if (file.Open(cachePath) && Attach(file.Data(), file.Size(), hash, Optimize))
+            {
+#ifdef OBJL_CONSOLE_OUTPUT
+                std::cout << "- " << Path << "\t| mesh cache > " << cachePath << std::endl;
+                PrintOptimization();
+#endif
+                return true;
+            }
+            file.Close();
+
+            Loader loader;
+            if (!loader.LoadFile(Path))
+                return false;
+            image = Build(loader, hash, Optimize);
+
+            // Without a writable directory the OBJ is simply parsed again next time
+            std::string tempPath = cachePath + ".tmp";
+            std::ofstream out(tempPath, std::ios::binary);
+            out.write(image.data(), image.size());
+            out.close();
+            if (out)
+            {
+                std::remove(cachePath.c_str());
+                std::rename(tempPath.c_str(), cachePath.c_str());
+            }
+            else
+            {
+                std::remove(tempPath.c_str());
+            }
+
+            bool attached = Attach(image.data(), image.size(), hash, Optimize);
+#ifdef OBJL_CONSOLE_OUTPUT
+            PrintOptimization();
+#endif
+            return attached;
+        }
+
+        // Print the cache miss ratio and overdraw before and
+        //	after the optimization, if the mesh has been optimized
+        void PrintOptimization() const
+        {
+            if (!Optimized)
+                return;
+            std::cout << "- vertex cache ACMR " << Optimization.AcmrBefore << " -> " << Optimization.AcmrAfter
+                      << "\t| overdraw " << Optimization.OverdrawBefore << " -> " << Optimization.OverdrawAfter << std::endl;
+        }
+
+        void Close()
+        {
+            file.Close();
+            image.clear();
+            MeshCount = VertexCount = IndexCount = 0;
+            Positions = Normals = nullptr;
+            TextureCoordinates = nullptr;
+            Indices = MaterialIds = nullptr;
+            MaterialNames.clear();
+            Optimized = false;
+            Optimization = MeshOptimizationReport{};
+        }
+
+        uint32_t MeshCount = 0;
+        uint32_t VertexCount = 0;
+        uint32_t IndexCount = 0;
+        // VertexCount each, Loader::LoadedVertices with the
+        //	duplicates welded by algorithm::WeldVertices; smooth
+        //	normals when the OBJ has none
+        const Vector3* Positions = nullptr;
+        const Vector3* Normals = nullptr;
+        const Vector2* TextureCoordinates = nullptr;
+        // IndexCount, Loader::LoadedIndices into the welded vertices
+        const unsigned int* Indices = nullptr;
+        // IndexCount / 3, into MaterialNames
+        const unsigned int* MaterialIds = nullptr;
+        std::vector<std::string> MaterialNames;
+        Vector3 BoundsMin;
+        Vector3 BoundsMax;
+        // whether LoadFile optimized the mesh, and what it gained
+        bool Optimized = false;
+        MeshOptimizationReport Optimization = {};
+
+    private:
+        static const uint32_t Version = 3;
+
+        static size_t Align(size_t offset)
+        {
+            return (offset + 15) & ~size_t(15);
+        }
+
+        // Lay out a cache file for the meshes of a loaded OBJ,
+        //	with its vertices welded and optionally optimized
+        static std::vector<char> Build(const Loader& loader, uint64_t hash, bool optimize)
+        {
+            static_assert(sizeof(Vector3) == 3 * sizeof(float) && sizeof(Vector2) == 2 * sizeof(float),
+                          "cache arrays are read as Vector3 and Vector2");
+
+            std::vector<std::string> names;
+            std::vector<unsigned int> materialIds;
+            materialIds.reserve(loader.LoadedIndices.size() / 3);
+            for (const auto& mesh : loader.LoadedMeshes)
+            {
+                const std::string name = mesh.MeshMaterial.name;
+                unsigned int id = (unsigned int)(std::find(names.begin(), names.end(), name) - names.begin());
+                if (id == names.size())
+                    names.push_back(name);
+                materialIds.insert(materialIds.end(), mesh.Indices.size() / 3, id);
+            }
+            // faces outside any mesh, which only a file with no faces can have
+            materialIds.resize(loader.LoadedIndices.size() / 3, 0);
+
+            std::vector<Vertex> weldedVertices;
+            std::vector<unsigned int> weldedIndices;
+            if (loader.LoadedNormals)
+            {
+                algorithm::WeldVertices(loader.LoadedVertices, loader.LoadedIndices, weldedVertices, weldedIndices);
+            }
+            else
+            {
+                // Face normals would keep every corner apart, so weld on
+                //	position and texture coordinate and smooth the normals
+                std::vector<Vertex> vertices = loader.LoadedVertices;
+                for (auto& v : vertices)
+                    v.Normal = Vector3(0, 0, 0);
+                algorithm::WeldVertices(vertices, loader.LoadedIndices, weldedVertices, weldedIndices);
+                algorithm::GenSmoothNormals(weldedVertices, weldedIndices);
+            }
+            MeshOptimizationReport optimization = {};
+            if (optimize)
+                optimization = algorithm::OptimizeMesh(weldedVertices, weldedIndices, materialIds);
+
+            MeshCacheHeader header;
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.Magic, "OBJLMESH", 8);
+            header.Version = Version;
+            header.MeshCount = (uint32_t)loader.LoadedMeshes.size();
+            header.SourceHash = hash;
+            header.VertexCount = (uint32_t)weldedVertices.size();
+            header.IndexCount = (uint32_t)weldedIndices.size();
+            header.MaterialCount = (uint32_t)names.size();
+            header.Optimized = optimize;
+            header.Optimization = optimization;
+
+            size_t vertices = header.VertexCount;
+            header.PositionsOffset = Align(sizeof(header));
+            header.NormalsOffset = Align(header.PositionsOffset + vertices * sizeof(Vector3));
+            header.TextureCoordinatesOffset = Align(header.NormalsOffset + vertices * sizeof(Vector3));
+            header.IndicesOffset = Align(header.TextureCoordinatesOffset + vertices * sizeof(Vector2));
+            header.MaterialIdsOffset = Align(header.IndicesOffset + header.IndexCount * sizeof(unsigned int));
+            header.MaterialNamesOffset = Align(header.MaterialIdsOffset + materialIds.size() * sizeof(unsigned int));
+            header.FileSize = header.MaterialNamesOffset;
+            for (const auto& name : names)
+                header.FileSize += name.size() + 1;
+
+            Vector3 lo(INFINITY, INFINITY, INFINITY), hi(-INFINITY, -INFINITY, -INFINITY);
+            std::vector<char> image(header.FileSize, 0);
+            char* base = image.data();
+            for (size_t i = 0; i < vertices; i++)
+            {
+                const Vertex& v = weldedVertices[i];
+                std::memcpy(base + header.PositionsOffset + i * sizeof(Vector3), &v.Position, sizeof(Vector3));
+                std::memcpy(base + header.NormalsOffset + i * sizeof(Vector3), &v.Normal, sizeof(Vector3));
+                std::memcpy(base + header.TextureCoordinatesOffset + i * sizeof(Vector2), &v.TextureCoordinate, sizeof(Vector2));
+                lo = Vector3(std::min(lo.X, v.Position.X), std::min(lo.Y, v.Position.Y), std::min(lo.Z, v.Position.Z));
+                hi = Vector3(std::max(hi.X, v.Position.X), std::max(hi.Y, v.Position.Y), std::max(hi.Z, v.Position.Z));
+            }
+            header.BoundsMin[0] = lo.X;
+            header.BoundsMin[1] = lo.Y;
+            header.BoundsMin[2] = lo.Z;
+            header.BoundsMax[0] = hi.X;
+            header.BoundsMax[1] = hi.Y;
+            header.BoundsMax[2] = hi.Z;
+            if (!weldedIndices.empty())
+                std::memcpy(base + header.IndicesOffset, weldedIndices.data(), header.IndexCount * sizeof(unsigned int));
+            if (!materialIds.empty())
+                std::memcpy(base + header.MaterialIdsOffset, materialIds.data(), materialIds.size() * sizeof(unsigned int));
+            char* name = base + header.MaterialNamesOffset;
+            for (const auto& n : names)
+            {
+                std::memcpy(name, n.c_str(), n.size() + 1);
+                name += n.size() + 1;
+            }
+            std::memcpy(base, &header, sizeof(header));
+            return image;
+        }
+
+        // Whether count elements of elementSize bytes at offset lie
+        //	inside an image of size bytes, 4 byte aligned
+        static bool ArrayInImage(uint64_t offset, uint64_t count, size_t elementSize, size_t size)
+        {
+            return offset % 4 == 0 && offset <= size && count <= (size - offset) / elementSize;
+        }
+
+        // Point the arrays into a cache image if it is complete
+        //	and was built from the OBJ with the given hash, optimized
+        //	or not as asked
+        bool Attach(const char* data, size_t size, uint64_t hash, bool optimize)
+        {
+            MeshCacheHeader header;
+            if (!data || size < sizeof(header))
+                return false;
+            std::memcpy(&header, data, sizeof(header));
+            if (std::memcmp(header.Magic, "OBJLMESH", 8) != 0 || header.Version != Version
+                || header.SourceHash != hash || header.FileSize != size || header.Optimized != uint32_t(optimize)
+                || header.MaterialNamesOffset > size)
+                return false;
+            if (!ArrayInImage(header.PositionsOffset, header.VertexCount, sizeof(Vector3), size)
+                || !ArrayInImage(header.NormalsOffset, header.VertexCount, sizeof(Vector3), size)
+                || !ArrayInImage(header.TextureCoordinatesOffset, header.VertexCount, sizeof(Vector2), size)
+                || !ArrayInImage(header.IndicesOffset, header.IndexCount, sizeof(unsigned int), size)
+                || !ArrayInImage(header.MaterialIdsOffset, header.IndexCount / 3, sizeof(unsigned int), size))
+                return false;
+            const unsigned int* indices = (const unsigned int*)(data + header.IndicesOffset);
+            for (uint32_t i = 0; i < header.IndexCount; i++)
+                if (indices[i] >= header.VertexCount)
+                    return false;
+            const unsigned int* materialIds = (const unsigned int*)(data + header.MaterialIdsOffset);
+            for (uint32_t i = 0; i < header.IndexCount / 3; i++)
+                if (materialIds[i] >= header.MaterialCount)
+                    return false;
+
+            // every name must end inside the image, or MaterialIds index past MaterialNames
+            std::vector<std::string> names;
+            const char* name = data + header.MaterialNamesOffset;
+            while (names.size() < header.MaterialCount && name < data + size)
+            {
+                size_t length = strnlen(name, data + size - name);
+                if (name + length == data + size)
+                    return false;
+                names.push_back(std::string(name, length));
+                name += length + 1;
+            }
+            if (names.size() != header.MaterialCount)
+                return false;
+
+            MeshCount = header.MeshCount;
+            VertexCount = header.VertexCount;
+            IndexCount = header.IndexCount;
+            Positions = (const Vector3*)(data + header.PositionsOffset);
+            Normals = (const Vector3*)(data + header.NormalsOffset);
+            TextureCoordinates = (const Vector2*)(data + header.TextureCoordinatesOffset);
+            Indices = (const unsigned int*)(data + header.IndicesOffset);
+            MaterialIds = (const unsigned int*)(data + header.MaterialIdsOffset);
+            BoundsMin = Vector3(header.BoundsMin[0], header.BoundsMin[1], header.BoundsMin[2]);
+            BoundsMax = Vector3(header.BoundsMax[0], header.BoundsMax[1], header.BoundsMax[2]);
+            Optimized = header.Optimized != 0;
+            Optimization = header.Optimization;
+            MaterialNames.swap(names);
+            return true;
+        }
+
+        parse::MappedFile file;
+        // the cache built on this load, when there was none to map
+        std::vector<char> image;
+    };
 }
 #endif //RASTERIZER_OBJ_LOADER_H
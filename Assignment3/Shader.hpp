@@ -1,8 +1,31 @@
 #ifndef RASTERIZER_SHADER_H
 #define RASTERIZER_SHADER_H
 #include <eigen3/Eigen/Eigen>
+#include <vector>
 #include "Texture.hpp"
 
+struct light
+{
+    Eigen::Vector3f position;
+    Eigen::Vector3f intensity;
+};
+
+// Constants shared by every fragment of a draw: lights, camera and material.
+// Bound once with rasterizer::set_uniforms and read through payload.uniforms.
+struct uniform_block
+{
+    std::vector<light> lights;
+    Eigen::Vector3f amb_light_intensity = Eigen::Vector3f(10, 10, 10);
+    Eigen::Vector3f eye_pos = Eigen::Vector3f(0, 0, 10);
+
+    Eigen::Vector3f ka = Eigen::Vector3f(0.005, 0.005, 0.005);
+    Eigen::Vector3f ks = Eigen::Vector3f(0.7937, 0.7937, 0.7937);
+    float p = 150;
+
+    // bump and displacement mapping
+    float kh = 0.2f, kn = 0.1f;
+};
+
 
 struct fragment_shader_payload
 {
@@ -11,7 +34,7 @@ struct fragment_shader_payload
         texture = nullptr;
     }
 
-    fragment_shader_payload(const Eigen::Vector3f& col, const Eigen::Vector3f& nor,const Eigen::Vector2f& tc, std::shared_ptr<Texture> tex) :
+    fragment_shader_payload(const Eigen::Vector3f& col, const Eigen::Vector3f& nor,const Eigen::Vector2f& tc, Texture* tex) :
          color(col), normal(nor), tex_coords(tc), texture(tex) {}
 
 
@@ -19,7 +42,15 @@ struct fragment_shader_payload
     Eigen::Vector3f color;
     Eigen::Vector3f normal;
     Eigen::Vector2f tex_coords;
-    std::shared_ptr<Texture> texture;
+    // view space direction of increasing u, interpolated and not normalized
+    Eigen::Vector3f tangent = Eigen::Vector3f::Zero();
+    // screen space derivatives of tex_coords, for mip level selection
+    Eigen::Vector2f tex_dx = Eigen::Vector2f::Zero();
+    Eigen::Vector2f tex_dy = Eigen::Vector2f::Zero();
+    // not owning, the rasterizer keeps the texture alive; a raw pointer avoids
+    // a reference count update for every shaded pixel
+    Texture* texture;
+    const uniform_block* uniforms = nullptr;
 };
 
 struct vertex_shader_payload
@@ -27,4 +58,18 @@ struct vertex_shader_payload
     Eigen::Vector3f position;
 };
 
+// Model space attributes of up to 8 consecutive vertices, one array per component.
+// A batch vertex shader may rewrite any of them; the rasterizer then applies the
+// model-view-projection and normal transforms to the whole batch.
+struct vertex_batch
+{
+    static const int size = 8;
+    int count; // valid lanes
+    alignas(32) float px[size], py[size], pz[size];
+    alignas(32) float nx[size], ny[size], nz[size];
+    alignas(32) float tx[size], ty[size], tz[size];
+    alignas(32) float u[size], v[size];
+    alignas(32) float r[size], g[size], b[size]; // color in 0-1
+};
+
 #endif //RASTERIZER_SHADER_H
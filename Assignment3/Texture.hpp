@@ -2,18 +2,69 @@
 #define RASTERIZER_TEXTURE_H
 #include <eigen3/Eigen/Eigen>
 #include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
 #include "global.hpp"
 
+// Nearest is the plain level 0 lookup getColor has always done; Bilinear filters the
+// closest mip level and Trilinear blends the two levels around the level of detail.
+enum class TextureFilter
+{
+	Nearest,
+	Bilinear,
+	Trilinear
+};
+
 class Texture
 {
 public:
 	Texture(const std::string &name)
 	{
-		image_data = cv::imread(name);
+		cv::Mat image_data = cv::imread(name);
 		cv::cvtColor(image_data, image_data, cv::COLOR_RGB2BGR);
 		width = image_data.cols;
 		height = image_data.rows;
+
+		mips.push_back(make_level(width, height));
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				auto color = image_data.at<cv::Vec3b>(y, x);
+				texel(mips[0], x, y) = Eigen::Vector3f(color[0], color[1], color[2]);
+			}
+		}
+		build_mips();
+	}
+
+	void set_filter(TextureFilter f) { filter = f; }
+
+	// Precomputes, for every level 0 texel, the height |color| and its forward differences
+	// toward the next texel in +u and in +v, for getHeightGradient.
+	void build_height_map()
+	{
+		height_map = make_level(width, height);
+		for (int y = 0; y < height; y++)
+			for (int x = 0; x < width; x++)
+				texel(height_map, x, y) = height_differences(x, y);
+	}
+
+	bool has_height_map() const { return !height_map.texels.empty(); }
+
+	// (height, dheight along +u, dheight along +v) at the texel getColor(u, v) reads;
+	// from the precomputed map after build_height_map, else differenced from the texels
+	Eigen::Vector3f getHeightGradient(float u, float v) const
+	{
+		u = std::max(0.f, std::min(u, 0.99f));
+		v = std::max(0.f, std::min(v, 0.99f));
+		int u_img = u * width;
+		int v_img = std::min((int)((1 - v) * height), height - 1);
+		if (has_height_map())
+			return texel(height_map, u_img, v_img);
+		return height_differences(u_img, v_img);
 	}
+	int levels() const { return (int)mips.size(); }
 
 	Eigen::Vector3f getColor(float u, float v)
 	{
@@ -22,13 +73,136 @@ public:
 		u = std::max(u, 0.f);
 		v = std::min(v, 0.99f);
 		v = std::max(v, 0.f);
-		auto u_img = u * width;
-		auto v_img = (1 - v) * height;
-		auto color = image_data.at<cv::Vec3b>(v_img, u_img);
-		return Eigen::Vector3f(color[0], color[1], color[2]);
+		int u_img = u * width;
+		int v_img = std::min((int)((1 - v) * height), height - 1);
+		return texel(mips[0], u_img, v_img);
+	}
+
+	// Bilinear lookup on one mip level with clamp-to-edge addressing
+	Eigen::Vector3f getColorBilinear(float u, float v, int level = 0) const
+	{
+		const mip_level &m = mips[std::max(0, std::min(level, levels() - 1))];
+		u = std::max(0.f, std::min(u, 1.f));
+		v = std::max(0.f, std::min(v, 1.f));
+		float x = u * m.width - 0.5f;
+		float y = (1 - v) * m.height - 0.5f;
+		int x0 = (int)std::floor(x);
+		int y0 = (int)std::floor(y);
+		float fx = x - x0;
+		float fy = y - y0;
+		int x1 = std::min(x0 + 1, m.width - 1);
+		int y1 = std::min(y0 + 1, m.height - 1);
+		x0 = std::max(x0, 0);
+		y0 = std::max(y0, 0);
+		Eigen::Vector3f top = (1 - fx) * texel(m, x0, y0) + fx * texel(m, x1, y0);
+		Eigen::Vector3f bottom = (1 - fx) * texel(m, x0, y1) + fx * texel(m, x1, y1);
+		return (1 - fy) * top + fy * bottom;
+	}
+
+	// Filtered lookup; duv_dx and duv_dy are the screen space derivatives of (u, v),
+	// which pick the mip level.
+	Eigen::Vector3f sample(const Eigen::Vector2f &uv, const Eigen::Vector2f &duv_dx, const Eigen::Vector2f &duv_dy)
+	{
+		if (filter == TextureFilter::Nearest)
+			return getColor(uv.x(), uv.y());
+
+		float lod = level_of_detail(duv_dx, duv_dy);
+		if (filter == TextureFilter::Bilinear)
+			return getColorBilinear(uv.x(), uv.y(), (int)(lod + 0.5f));
+
+		int level = (int)lod;
+		float t = lod - level;
+		Eigen::Vector3f color = getColorBilinear(uv.x(), uv.y(), level);
+		if (t > 0 && level + 1 < levels())
+			color = (1 - t) * color + t * getColorBilinear(uv.x(), uv.y(), level + 1);
+		return color;
 	}
 
 	int width, height;
-	cv::Mat image_data;
+
+private:
+	// Texels are stored as floats in 8x8 tiles, Morton ordered inside a tile, so a
+	// bilinear footprint and a small triangle's texels share a few cache lines.
+	struct mip_level
+	{
+		int width, height;
+		int tiles_x;
+		std::vector<Eigen::Vector3f> texels;
+	};
+
+	static mip_level make_level(int w, int h)
+	{
+		mip_level m;
+		m.width = w;
+		m.height = h;
+		m.tiles_x = (w + 7) / 8;
+		m.texels.resize(m.tiles_x * ((h + 7) / 8) * 64);
+		return m;
+	}
+
+	// (height, dheight along +u, dheight along +v) at level 0 texel (x, y), the height
+	// being |color|
+	Eigen::Vector3f height_differences(int x, int y) const
+	{
+		const mip_level &src = mips[0];
+		float h = texel(src, x, y).norm();
+		// rows run from v = 1 down to v = 0, so +v is the row above
+		float h_u = texel(src, std::min(x + 1, width - 1), y).norm();
+		float h_v = texel(src, x, std::max(y - 1, 0)).norm();
+		return Eigen::Vector3f(h, h_u - h, h_v - h);
+	}
+
+	static int morton(int x, int y)
+	{
+		int mx = (x & 1) | ((x & 2) << 1) | ((x & 4) << 2);
+		int my = (y & 1) | ((y & 2) << 1) | ((y & 4) << 2);
+		return mx | (my << 1);
+	}
+
+	static Eigen::Vector3f &texel(mip_level &m, int x, int y)
+	{
+		return m.texels[((y >> 3) * m.tiles_x + (x >> 3)) * 64 + morton(x & 7, y & 7)];
+	}
+
+	static const Eigen::Vector3f &texel(const mip_level &m, int x, int y)
+	{
+		return m.texels[((y >> 3) * m.tiles_x + (x >> 3)) * 64 + morton(x & 7, y & 7)];
+	}
+
+	// 2x2 box filter down to 1x1; odd sizes repeat the last row or column
+	void build_mips()
+	{
+		while (mips.back().width > 1 || mips.back().height > 1)
+		{
+			const mip_level &src = mips.back();
+			mip_level dst = make_level(std::max(1, src.width / 2), std::max(1, src.height / 2));
+			for (int y = 0; y < dst.height; y++)
+			{
+				int y0 = std::min(2 * y, src.height - 1);
+				int y1 = std::min(2 * y + 1, src.height - 1);
+				for (int x = 0; x < dst.width; x++)
+				{
+					int x0 = std::min(2 * x, src.width - 1);
+					int x1 = std::min(2 * x + 1, src.width - 1);
+					texel(dst, x, y) = 0.25f * (texel(src, x0, y0) + texel(src, x1, y0) + texel(src, x0, y1) + texel(src, x1, y1));
+				}
+			}
+			mips.push_back(std::move(dst));
+		}
+	}
+
+	float level_of_detail(const Eigen::Vector2f &duv_dx, const Eigen::Vector2f &duv_dy) const
+	{
+		Eigen::Vector2f dx(duv_dx.x() * width, duv_dx.y() * height);
+		Eigen::Vector2f dy(duv_dy.x() * width, duv_dy.y() * height);
+		float rho2 = std::max(dx.squaredNorm(), dy.squaredNorm());
+		if (!(rho2 > 1))
+			return 0;
+		return std::min(0.5f * std::log2(rho2), (float)(levels() - 1));
+	}
+
+	std::vector<mip_level> mips;
+	mip_level height_map{};
+	TextureFilter filter = TextureFilter::Trilinear;
 };
 #endif //RASTERIZER_TEXTURE_H
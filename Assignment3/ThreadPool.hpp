@@ -0,0 +1,116 @@
+#ifndef RASTERIZER_THREADPOOL_H
+#define RASTERIZER_THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that run parallel_for jobs.
+// The calling thread takes part in every job, so a pool of n threads
+// keeps n + 1 cores busy.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(int num_threads = 0)
+	{
+		if (num_threads <= 0)
+			num_threads = std::max(1, (int)std::thread::hardware_concurrency()) - 1;
+		for (int i = 0; i < num_threads; i++)
+			workers.emplace_back([this] { worker_loop(); });
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		wake.notify_all();
+		for (auto &w : workers)
+			w.join();
+	}
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	int size() const { return (int)workers.size() + 1; }
+
+	// Calls fn(i) for every i in [0, count). Returns once all calls have finished.
+	void parallel_for(int count, const std::function<void(int)> &fn)
+	{
+		if (count <= 0)
+			return;
+		if (workers.empty() || count == 1)
+		{
+			for (int i = 0; i < count; i++)
+				fn(i);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job = &fn;
+			job_count = count;
+			next_index = 0;
+			active = (int)workers.size();
+			generation++;
+		}
+		wake.notify_all();
+
+		run_job(fn, count);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this] { return active == 0; });
+		job = nullptr;
+	}
+
+private:
+	void run_job(const std::function<void(int)> &fn, int count)
+	{
+		for (int i = next_index++; i < count; i = next_index++)
+			fn(i);
+	}
+
+	void worker_loop()
+	{
+		unsigned long long seen = 0;
+		for (;;)
+		{
+			const std::function<void(int)> *fn;
+			int count;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&] { return stop || generation != seen; });
+				if (stop)
+					return;
+				seen = generation;
+				fn = job;
+				count = job_count;
+			}
+
+			run_job(*fn, count);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--active == 0)
+				done.notify_one();
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+
+	const std::function<void(int)> *job = nullptr;
+	int job_count = 0;
+	std::atomic<int> next_index{ 0 };
+	int active = 0;
+	unsigned long long generation = 0;
+	bool stop = false;
+};
+
+#endif //RASTERIZER_THREADPOOL_H
@@ -23,10 +23,15 @@ public:
 		normal[0] << 0.0, 0.0, 0.0;
 		normal[1] << 0.0, 0.0, 0.0;
 		normal[2] << 0.0, 0.0, 0.0;
+
+		tangent[0] << 0.0, 0.0, 0.0;
+		tangent[1] << 0.0, 0.0, 0.0;
+		tangent[2] << 0.0, 0.0, 0.0;
 	}
 
 	void setVertex(int ind, const Eigen::Vector4f &ver) { v[ind] = ver; }
 	void setNormal(int ind, const Eigen::Vector3f &n) { normal[ind] = n; }
+	void setTangent(int ind, const Eigen::Vector3f &t) { tangent[ind] = t; }
 	void setTexCoord(int ind, const Eigen::Vector2f &tc) { tex_coords[ind] = tc; }
 	void setColor(int ind, float r, float g, float b)
 	{
@@ -58,6 +63,7 @@ public:
 	Eigen::Vector3f color[3];
 	Eigen::Vector2f tex_coords[3];
 	Eigen::Vector3f normal[3];
+	Eigen::Vector3f tangent[3];
 	std::shared_ptr<Texture> texture;
 };
 
@@ -0,0 +1,95 @@
+#ifndef RASTERIZER_VERTEXBATCH_H
+#define RASTERIZER_VERTEXBATCH_H
+
+#include <algorithm>
+#include "EdgeFunction.hpp"
+#include "MeshBuffer.hpp"
+#include "Shader.hpp"
+
+namespace rst
+{
+	// out[l] = row[0] * x[l] + row[1] * y[l] + row[2] * z[l] + row[3] for the 8 lanes of a batch,
+	// one row of a transform applied to points (or to directions when row[3] is 0)
+	inline void transform_row8(const float *row, const float *x, const float *y, const float *z, float *out)
+	{
+#if defined(RST_SIMD_AVX2)
+		__m256 r = _mm256_mul_ps(_mm256_set1_ps(row[0]), _mm256_load_ps(x));
+		r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_set1_ps(row[1]), _mm256_load_ps(y)));
+		r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_set1_ps(row[2]), _mm256_load_ps(z)));
+		_mm256_store_ps(out, _mm256_add_ps(r, _mm256_set1_ps(row[3])));
+#elif defined(RST_SIMD_SSE)
+		for (int half = 0; half < 8; half += 4)
+		{
+			__m128 r = _mm_mul_ps(_mm_set1_ps(row[0]), _mm_load_ps(x + half));
+			r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(row[1]), _mm_load_ps(y + half)));
+			r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(row[2]), _mm_load_ps(z + half)));
+			_mm_store_ps(out + half, _mm_add_ps(r, _mm_set1_ps(row[3])));
+		}
+#else
+		for (int l = 0; l < 8; l++)
+			out[l] = row[0] * x[l] + row[1] * y[l] + row[2] * z[l] + row[3];
+#endif
+	}
+
+	// Fills a batch from the vertex streams starting at first. Missing normals load as (0, 0, 1),
+	// missing tangents as (1, 0, 0), missing texcoords as (0, 0) and missing colors as the default
+	// spot color. Unused lanes repeat the last vertex so every lane holds finite values.
+	inline void load_batch(const vec3_stream &pos, const vec3_stream *col, const vec3_stream *nor, const vec3_stream *tan,
+		const vec2_stream *tex, size_t first, vertex_batch &b)
+	{
+		b.count = (int)std::min<size_t>(vertex_batch::size, pos.size() - first);
+		size_t col_count = col ? col->size() : 0;
+		for (int l = 0; l < vertex_batch::size; l++)
+		{
+			size_t i = first + std::min(l, b.count - 1);
+			b.px[l] = pos.x[i];
+			b.py[l] = pos.y[i];
+			b.pz[l] = pos.z[i];
+			b.nx[l] = nor ? nor->x[i] : 0.0f;
+			b.ny[l] = nor ? nor->y[i] : 0.0f;
+			b.nz[l] = nor ? nor->z[i] : 1.0f;
+			b.tx[l] = tan ? tan->x[i] : 1.0f;
+			b.ty[l] = tan ? tan->y[i] : 0.0f;
+			b.tz[l] = tan ? tan->z[i] : 0.0f;
+			b.u[l] = tex ? tex->x[i] : 0.0f;
+			b.v[l] = tex ? tex->y[i] : 0.0f;
+			b.r[l] = i < col_count ? col->x[i] / 255.0f : 148 / 255.0f;
+			b.g[l] = i < col_count ? col->y[i] / 255.0f : 121 / 255.0f;
+			b.b[l] = i < col_count ? col->z[i] / 255.0f : 92 / 255.0f;
+		}
+	}
+
+	// Leaves the batch unchanged
+	struct identity_vertex_shader
+	{
+		void operator()(vertex_batch &) const {}
+	};
+
+	// Runs a shader written for one vertex_shader_payload on every valid lane of a batch
+	template <typename VertexShader>
+	struct per_vertex_shader
+	{
+		const VertexShader &shader;
+
+		void operator()(vertex_batch &b) const
+		{
+			vertex_shader_payload payload;
+			for (int l = 0; l < b.count; l++)
+			{
+				payload.position = Eigen::Vector3f(b.px[l], b.py[l], b.pz[l]);
+				Eigen::Vector3f p = shader(payload);
+				b.px[l] = p.x();
+				b.py[l] = p.y();
+				b.pz[l] = p.z();
+			}
+		}
+	};
+
+	template <typename VertexShader>
+	per_vertex_shader<VertexShader> make_per_vertex_shader(const VertexShader &shader)
+	{
+		return per_vertex_shader<VertexShader>{ shader };
+	}
+} // namespace rst
+
+#endif //RASTERIZER_VERTEXBATCH_H
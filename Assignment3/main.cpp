@@ -1,5 +1,13 @@
 #include <eigen3/Eigen/Eigen>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <future>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #include <opencv2/opencv.hpp>
 
 #include "rasterizer.hpp"
@@ -31,28 +39,19 @@ Eigen::Vector3f normal_fragment_shader(const fragment_shader_payload &payload)
 //	return (2 * costheta * axis - vec).normalized();
 //}
 
-struct light
-{
-	Eigen::Vector3f position;
-	Eigen::Vector3f intensity;
-};
-
 Eigen::Vector3f phong_fragment_shader(const fragment_shader_payload &payload)
 {
-	Eigen::Vector3f ka = Eigen::Vector3f(0.005, 0.005, 0.005);
+	const uniform_block &uniforms = *payload.uniforms;
+	const Eigen::Vector3f &ka = uniforms.ka;
 	Eigen::Vector3f kd = payload.color;
-	Eigen::Vector3f ks = Eigen::Vector3f(0.7937, 0.7937, 0.7937);
-
-	auto l1 = light{ {20, 20, 20}, {500, 500, 500} };
-	auto l2 = light{ {-20, 20, 0}, {500, 500, 500} };
+	const Eigen::Vector3f &ks = uniforms.ks;
 
-	std::vector<light> lights = { l1, l2 };
-	Eigen::Vector3f amb_light_intensity{ 10, 10, 10 };
-	Eigen::Vector3f eye_pos{ 0, 0, 10 };
+	const std::vector<light> &lights = uniforms.lights;
+	const Eigen::Vector3f &amb_light_intensity = uniforms.amb_light_intensity;
+	const Eigen::Vector3f &eye_pos = uniforms.eye_pos;
 
-	float p = 150;
+	float p = uniforms.p;
 
-	Eigen::Vector3f color = payload.color;
 	Eigen::Vector3f point = payload.view_pos;
 	Eigen::Vector3f normal = payload.normal;
 
@@ -75,31 +74,20 @@ Eigen::Vector3f phong_fragment_shader(const fragment_shader_payload &payload)
 	return result_color;
 }
 
-Eigen::Vector3f texture_fragment_shader(const fragment_shader_payload &payload)
+// Phong lighting with the diffuse color taken from a texture lookup, in 0..255
+Eigen::Vector3f textured_phong(const fragment_shader_payload &payload, const Eigen::Vector3f &texture_color)
 {
-	Eigen::Vector3f return_color = { 0, 0, 0 };
-	if (payload.texture)
-	{
-		// TODO: Get the texture value at the texture coordinates of the current fragment
-		return_color = payload.texture->getColor(payload.tex_coords.x(), payload.tex_coords.y());
-	}
-	Eigen::Vector3f texture_color;
-	texture_color << return_color.x(), return_color.y(), return_color.z();
-
-	Eigen::Vector3f ka = Eigen::Vector3f(0.005, 0.005, 0.005);
+	const uniform_block &uniforms = *payload.uniforms;
+	const Eigen::Vector3f &ka = uniforms.ka;
 	Eigen::Vector3f kd = texture_color / 255.f;
-	Eigen::Vector3f ks = Eigen::Vector3f(0.7937, 0.7937, 0.7937);
-
-	auto l1 = light{ {20, 20, 20}, {500, 500, 500} };
-	auto l2 = light{ {-20, 20, 0}, {500, 500, 500} };
+	const Eigen::Vector3f &ks = uniforms.ks;
 
-	std::vector<light> lights = { l1, l2 };
-	Eigen::Vector3f amb_light_intensity{ 10, 10, 10 };
-	Eigen::Vector3f eye_pos{ 0, 0, 10 };
+	const std::vector<light> &lights = uniforms.lights;
+	const Eigen::Vector3f &amb_light_intensity = uniforms.amb_light_intensity;
+	const Eigen::Vector3f &eye_pos = uniforms.eye_pos;
 
-	float p = 150;
+	float p = uniforms.p;
 
-	Eigen::Vector3f color = texture_color;
 	Eigen::Vector3f point = payload.view_pos;
 	Eigen::Vector3f normal = payload.normal;
 
@@ -123,54 +111,48 @@ Eigen::Vector3f texture_fragment_shader(const fragment_shader_payload &payload)
 	return result_color;
 }
 
-Eigen::Vector3f bump_fragment_shader(const fragment_shader_payload &payload)
+Eigen::Vector3f texture_fragment_shader(const fragment_shader_payload &payload)
 {
+	Eigen::Vector3f return_color = { 0, 0, 0 };
+	if (payload.texture)
+	{
+		// TODO: Get the texture value at the texture coordinates of the current fragment
+		return_color = payload.texture->sample(payload.tex_coords, payload.tex_dx, payload.tex_dy);
+	}
+	Eigen::Vector3f texture_color;
+	texture_color << return_color.x(), return_color.y(), return_color.z();
 
-	Eigen::Vector3f ka = Eigen::Vector3f(0.005, 0.005, 0.005);
-	Eigen::Vector3f kd = payload.color;
-	Eigen::Vector3f ks = Eigen::Vector3f(0.7937, 0.7937, 0.7937);
-
-	auto l1 = light{ {20, 20, 20}, {500, 500, 500} };
-	auto l2 = light{ {-20, 20, 0}, {500, 500, 500} };
+	return textured_phong(payload, texture_color);
+}
 
-	std::vector<light> lights = { l1, l2 };
-	Eigen::Vector3f amb_light_intensity{ 10, 10, 10 };
-	Eigen::Vector3f eye_pos{ 0, 0, 10 };
+Eigen::Vector3f bump_fragment_shader(const fragment_shader_payload &payload)
+{
 
-	float p = 150;
+	const uniform_block &uniforms = *payload.uniforms;
 
-	Eigen::Vector3f color = payload.color;
-	Eigen::Vector3f point = payload.view_pos;
 	Eigen::Vector3f normal = payload.normal;
 
 
-	float kh = 0.2, kn = 0.1;
+	float kh = uniforms.kh, kn = uniforms.kn;
 
 	// TODO: Implement bump mapping here
 	// Let n = normal = (x, y, z)
-	// Vector t = (x*y/sqrt(x*x+z*z),sqrt(x*x+z*z),z*y/sqrt(x*x+z*z))
+	// Vector t = the interpolated vertex tangent, made orthogonal to n
 	// Vector b = n cross product t
 	// Matrix TBN = [t b n]
 	// dU = kh * kn * (h(u+1/w,v)-h(u,v))
 	// dV = kh * kn * (h(u,v+1/h)-h(u,v))
 	// Vector ln = (-dU, -dV, 1)
 	// Normal n = normalize(TBN * ln)
+	// h and both differences come from one lookup in the texture's precomputed height map
 	Eigen::Vector3f n = normal;
-	float x = n.x();
-	float y = n.y();
-	float z = n.z();
-	float sqxz = sqrt(x * x + z * z);
-	Eigen::Vector3f t = Eigen::Vector3f(x * y / sqxz, sqxz, z * y / sqxz);
-	t = (t - n.dot(t) * n).normalized();
-	Eigen::Vector3f b = n.cross(t).normalized();
+	Eigen::Vector3f t = (payload.tangent - n.dot(payload.tangent) * n).normalized();
+	Eigen::Vector3f b = n.cross(t);
 	Eigen::Matrix3f TBN;
 	TBN << t, b, n;
-	float w = payload.texture->width;
-	float h = payload.texture->height;
-	float u = payload.tex_coords.x();
-	float v = payload.tex_coords.y();
-	float du = kh * kn * (payload.texture->getColor(std::min(u + 1.0f / w, 1.f), v).norm() - payload.texture->getColor(u, v).norm());
-	float dv = kh * kn * (payload.texture->getColor(u, std::min(v + 1.0f / h, 1.f)).norm() - payload.texture->getColor(u, v).norm());
+	Eigen::Vector3f height = payload.texture->getHeightGradient(payload.tex_coords.x(), payload.tex_coords.y());
+	float du = kh * kn * height.y();
+	float dv = kh * kn * height.z();
 	Eigen::Vector3f ln(-du, -dv, 1);
 	n = (TBN * ln).normalized();
 
@@ -181,28 +163,25 @@ Eigen::Vector3f bump_fragment_shader(const fragment_shader_payload &payload)
 Eigen::Vector3f displacement_fragment_shader(const fragment_shader_payload &payload)
 {
 
-	Eigen::Vector3f ka = Eigen::Vector3f(0.005, 0.005, 0.005);
+	const uniform_block &uniforms = *payload.uniforms;
+	const Eigen::Vector3f &ka = uniforms.ka;
 	Eigen::Vector3f kd = payload.color;
-	Eigen::Vector3f ks = Eigen::Vector3f(0.7937, 0.7937, 0.7937);
-
-	auto l1 = light{ {20, 20, 20}, {500, 500, 500} };
-	auto l2 = light{ {-20, 20, 0}, {500, 500, 500} };
+	const Eigen::Vector3f &ks = uniforms.ks;
 
-	std::vector<light> lights = { l1, l2 };
-	Eigen::Vector3f amb_light_intensity{ 10, 10, 10 };
-	Eigen::Vector3f eye_pos{ 0, 0, 10 };
+	const std::vector<light> &lights = uniforms.lights;
+	const Eigen::Vector3f &amb_light_intensity = uniforms.amb_light_intensity;
+	const Eigen::Vector3f &eye_pos = uniforms.eye_pos;
 
-	float p = 150;
+	float p = uniforms.p;
 
-	Eigen::Vector3f color = payload.color;
 	Eigen::Vector3f point = payload.view_pos;
 	Eigen::Vector3f normal = payload.normal;
 
-	float kh = 0.2, kn = 0.1;
+	float kh = uniforms.kh, kn = uniforms.kn;
 
 	// TODO: Implement displacement mapping here
 	// Let n = normal = (x, y, z)
-	// Vector t = (x*y/sqrt(x*x+z*z),sqrt(x*x+z*z),z*y/sqrt(x*x+z*z))
+	// Vector t = the interpolated vertex tangent, made orthogonal to n
 	// Vector b = n cross product t
 	// Matrix TBN = [t b n]
 	// dU = kh * kn * (h(u+1/w,v)-h(u,v))
@@ -210,27 +189,19 @@ Eigen::Vector3f displacement_fragment_shader(const fragment_shader_payload &payl
 	// Vector ln = (-dU, -dV, 1)
 	// Position p = p + kn * n * h(u,v)
 	// Normal n = normalize(TBN * ln)
+	// h and both differences come from one lookup in the texture's precomputed height map
 	Eigen::Vector3f n = normal;
-	float x = n.x();
-	float y = n.y();
-	float z = n.z();
-	float sqxz = sqrt(x * x + z * z);
-	Eigen::Vector3f t = Eigen::Vector3f(x * y / sqxz, sqxz, z * y / sqxz);
-	t = (t - n.dot(t) * n).normalized(); 
-	Eigen::Vector3f b = n.cross(t).normalized();
+	Eigen::Vector3f t = (payload.tangent - n.dot(payload.tangent) * n).normalized();
+	Eigen::Vector3f b = n.cross(t);
 	Eigen::Matrix3f TBN;
 	TBN << t, b, n;
-	float w = payload.texture->width;
-	float h = payload.texture->height;
-	float u = payload.tex_coords.x();
-	float v = payload.tex_coords.y();
-	float du = kh * kn * (payload.texture->getColor(std::min(u + 1.0f / w, 1.f), v).norm() - payload.texture->getColor(u, v).norm());
-	float dv = kh * kn * (payload.texture->getColor(u, std::min(v + 1.0f / h, 1.f)).norm() - payload.texture->getColor(u, v).norm());
+	Eigen::Vector3f height = payload.texture->getHeightGradient(payload.tex_coords.x(), payload.tex_coords.y());
+	float du = kh * kn * height.y();
+	float dv = kh * kn * height.z();
 	Eigen::Vector3f ln(-du, -dv, 1);
 	n = (TBN * ln).normalized();
 
-	float offset = payload.texture->getColor(u, v).norm();
-	point += kn * normal * payload.texture->getColor(u, v).norm();
+	point += kn * normal * height.x();
 	Eigen::Vector3f result_color = { 0, 0, 0 };
 	for (auto &light : lights)
 	{
@@ -250,40 +221,642 @@ Eigen::Vector3f displacement_fragment_shader(const fragment_shader_payload &payl
 	return result_color;
 }
 
-int main(int argc, const char **argv)
+enum class ShaderType
 {
-	std::vector<Triangle *> TriangleList;
+	Normal,
+	Phong,
+	Texture,
+	Bump,
+	Displacement
+};
 
-	float angle = 140.0;
-	bool command_line = false;
-	std::string filename = "output.png";
-	objl::Loader Loader;
-	std::string obj_path = "../models/spot/";
+// Calls fn with a lambda wrapping the fragment shader, so each case instantiates the templated
+// draw with one shader and the shader inlines into the rasterizer's shading loop instead of
+// going through std::function for every pixel.
+template <typename Fn>
+void visit_fragment_shader(ShaderType shader, Fn &&fn)
+{
+	switch (shader)
+	{
+	case ShaderType::Normal:
+		fn([](const fragment_shader_payload &payload) { return normal_fragment_shader(payload); });
+		break;
+	case ShaderType::Phong:
+		fn([](const fragment_shader_payload &payload) { return phong_fragment_shader(payload); });
+		break;
+	case ShaderType::Texture:
+		fn([](const fragment_shader_payload &payload) { return texture_fragment_shader(payload); });
+		break;
+	case ShaderType::Bump:
+		fn([](const fragment_shader_payload &payload) { return bump_fragment_shader(payload); });
+		break;
+	case ShaderType::Displacement:
+		fn([](const fragment_shader_payload &payload) { return displacement_fragment_shader(payload); });
+		break;
+	}
+}
+
+void draw_mesh(rst::rasterizer &r, rst::mesh_buf_id mesh_id, ShaderType shader)
+{
+	auto vs = [](const vertex_shader_payload &payload) { return vertex_shader(payload); };
+	visit_fragment_shader(shader, [&](const auto &frag_shader) { r.draw(mesh_id, rst::Primitive::Triangle, vs, frag_shader); });
+}
+
+// Loads a texture used as a height map and precomputes its gradients for the bump and
+// displacement shaders
+std::shared_ptr<Texture> load_height_map(const std::string &name)
+{
+	auto texture = std::make_shared<Texture>(name);
+	texture->build_height_map();
+	return texture;
+}
+
+// milliseconds since start
+double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
 
-	// Load .obj File
-	bool loadout = Loader.LoadFile("../models/spot/spot_triangulated_good.obj");
-	for (auto mesh : Loader.LoadedMeshes)
+ShaderType shader_from_name(const std::string &name)
+{
+	if (name == "texture")
+		return ShaderType::Texture;
+	if (name == "normal")
+		return ShaderType::Normal;
+	if (name == "bump")
+		return ShaderType::Bump;
+	if (name == "displacement")
+		return ShaderType::Displacement;
+	return ShaderType::Phong;
+}
+
+#if RST_ENABLE_STATS
+void print_frame_stats(const rst::frame_stats &s)
+{
+	static const char *stage_names[] = { "vertex", "setup", "raster", "shade", "resolve" };
+	std::cout << "triangles submitted " << s.triangles_submitted << ", clipped " << s.triangles_clipped
+		<< ", culled " << s.triangles_culled << "\n";
+	std::cout << "pixels tested " << s.pixels_tested << ", samples tested " << s.samples_tested
+		<< ", depth passes " << s.depth_passes << ", fragments shaded " << s.fragments_shaded << "\n";
+	std::cout << "hierarchical z culled " << s.triangles_hiz_culled << " triangles, " << s.blocks_hiz_culled
+		<< " blocks; " << s.objects_occluded << " of " << s.occlusion_queries << " occlusion queries occluded\n";
+	std::cout << "meshlets tested " << s.meshlets_tested << ", frustum culled " << s.meshlets_frustum_culled
+		<< ", backface culled " << s.meshlets_backface_culled << "\n";
+	for (int i = 0; i < (int)rst::Stage::Count; i++)
+		std::cout << stage_names[i] << " " << s.stage_ms[i] << " ms" << (i + 1 < (int)rst::Stage::Count ? ", " : "\n");
+}
+
+// Scales a per-pixel map to its maximum and writes it false colored
+void write_heatmap(const std::vector<float> &map, const std::string &filename)
+{
+	float max_value = *std::max_element(map.begin(), map.end());
+	cv::Mat gray(HEIGHT, WIDTH, CV_8UC1);
+	for (int i = 0; i < WIDTH * HEIGHT; i++)
+		gray.data[i] = max_value > 0 ? (unsigned char)(map[i] / max_value * 255 + 0.5f) : 0;
+	cv::Mat heat;
+	cv::applyColorMap(gray, heat, cv::COLORMAP_JET);
+	cv::imwrite(filename, heat);
+	std::cout << filename << ": max " << max_value << "\n";
+}
+
+// output.png -> output_<suffix>.png
+std::string sibling_filename(const std::string &filename, const std::string &suffix)
+{
+	size_t dot = filename.find_last_of('.');
+	size_t slash = filename.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return filename + "_" + suffix + ".png";
+	return filename.substr(0, dot) + "_" + suffix + filename.substr(dot);
+}
+#endif
+
+// Synthetic benchmark geometry is given directly in normalized device coordinates and drawn
+// with identity matrices; colors are 0-255 like the loaded meshes.
+void push_triangle(rst::mesh_buffer &mesh, const Eigen::Vector3f (&v)[3], const Eigen::Vector3f &color)
+{
+	int base = mesh.vertex_count();
+	for (int i = 0; i < 3; i++)
+	{
+		mesh.positions.push_back(v[i]);
+		mesh.colors.push_back(color);
+		mesh.indices.push_back(base + i);
+	}
+}
+
+// Two triangles per cell of a grid with cells of cell_px pixels. The grid is shifted right by
+// a quarter pixel so no edge runs exactly through pixel centers.
+rst::mesh_buffer make_tiny_triangles(int cell_px)
+{
+	rst::mesh_buffer mesh;
+	int cells_x = WIDTH / cell_px - 1, cells_y = HEIGHT / cell_px;
+	float dx = 2.0f * cell_px / WIDTH, dy = 2.0f * cell_px / HEIGHT;
+	float shift = 0.5f / WIDTH;
+	mesh.reserve(cells_x * cells_y * 6, cells_x * cells_y * 2);
+	for (int j = 0; j < cells_y; j++)
 	{
-		for (int i = 0; i < mesh.Vertices.size(); i += 3)
+		for (int i = 0; i < cells_x; i++)
 		{
-			Triangle *t = new Triangle();
-			for (int j = 0; j < 3; j++)
+			float x = -1 + i * dx + shift, y = -1 + j * dy;
+			Eigen::Vector3f color(255.0f * i / cells_x, 255.0f * j / cells_y, 128);
+			Eigen::Vector3f lower[3] = { { x, y, 0 }, { x + dx, y, 0 }, { x + dx, y + dy, 0 } };
+			Eigen::Vector3f upper[3] = { { x, y, 0 }, { x + dx, y + dy, 0 }, { x, y + dy, 0 } };
+			push_triangle(mesh, lower, color);
+			push_triangle(mesh, upper, color);
+		}
+	}
+	return mesh;
+}
+
+// Layers of one triangle that covers the whole screen. Back to front every layer passes the
+// depth test; front to back hierarchical z rejects all but the first.
+rst::mesh_buffer make_fullscreen_triangles(int layers, bool front_to_back)
+{
+	rst::mesh_buffer mesh;
+	for (int i = 0; i < layers; i++)
+	{
+		float z = front_to_back ? -0.8f + 1.6f * i / layers : 0.8f - 1.6f * i / layers;
+		Eigen::Vector3f v[3] = { { -1, -1, z }, { 3, -1, z }, { -1, 3, z } };
+		push_triangle(mesh, v, Eigen::Vector3f(255.0f * i / layers, 64, 255.0f - 255.0f * i / layers));
+	}
+	return mesh;
+}
+
+// Slanted triangles one pixel wide that run from the bottom to the top of the screen
+rst::mesh_buffer make_sliver_triangles(int count)
+{
+	rst::mesh_buffer mesh;
+	float width = 2.0f / WIDTH;
+	for (int i = 0; i < count; i++)
+	{
+		float x = -1 + 1.5f * i / count;
+		Eigen::Vector3f v[3] = { { x, -1, 0 }, { x + width, -1, 0 }, { x + 0.5f, 1, 0 } };
+		push_triangle(mesh, v, Eigen::Vector3f(255.0f * i / count, 200, 64));
+	}
+	return mesh;
+}
+
+struct bench_result
+{
+	std::string workload;
+	std::string shader;
+	int msaa;
+	long long triangles;
+	long long fragments;
+	std::vector<double> frame_ms;
+};
+
+// Times one workload: a counting frame for the fragment count, warmup frames, then timed frames
+template <typename FragmentShader>
+bench_result run_bench_case(rst::rasterizer &r, rst::mesh_buf_id mesh_id, long long triangles, const FragmentShader &frag_shader,
+	int warmup, int frames)
+{
+	auto vs = [](const vertex_shader_payload &payload) { return vertex_shader(payload); };
+	bench_result result;
+	result.triangles = triangles;
+
+	std::atomic<long long> fragments{ 0 };
+	r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+	r.draw(mesh_id, rst::Primitive::Triangle, vs, [&](const fragment_shader_payload &payload) {
+		fragments.fetch_add(1, std::memory_order_relaxed);
+		return frag_shader(payload);
+	});
+	result.fragments = fragments;
+
+	for (int i = 0; i < warmup + frames; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+		r.draw(mesh_id, rst::Primitive::Triangle, vs, frag_shader);
+		if (i >= warmup)
+			result.frame_ms.push_back(elapsed_ms(start));
+	}
+	return result;
+}
+
+// The same through set_fragment_shader and forward shading, where the draw order and the depth
+// prepass decide how many fragments are shaded
+template <typename FragmentShader>
+bench_result run_forward_bench_case(rst::rasterizer &r, rst::mesh_buf_id mesh_id, long long triangles, const FragmentShader &frag_shader,
+	int warmup, int frames)
+{
+	bench_result result;
+	result.triangles = triangles;
+
+	std::atomic<long long> fragments{ 0 };
+	r.set_fragment_shader([&](const fragment_shader_payload &payload) {
+		fragments.fetch_add(1, std::memory_order_relaxed);
+		return frag_shader(payload);
+	});
+	r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+	r.draw(mesh_id, rst::Primitive::Triangle);
+	result.fragments = fragments;
+
+	r.set_fragment_shader(frag_shader);
+	for (int i = 0; i < warmup + frames; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+		r.draw(mesh_id, rst::Primitive::Triangle);
+		if (i >= warmup)
+			result.frame_ms.push_back(elapsed_ms(start));
+	}
+	return result;
+}
+
+// Writes all results as one JSON document; throughputs are computed from the median frame
+void write_bench_json(const std::vector<bench_result> &results, int warmup, int frames, const std::string &filename)
+{
+#if defined(RST_SIMD_AVX2)
+	const char *simd = "avx2";
+#elif defined(RST_SIMD_SSE)
+	const char *simd = "sse2";
+#else
+	const char *simd = "none";
+#endif
+	std::ofstream out(filename);
+	if (!out)
+		throw std::runtime_error("Cannot open " + filename);
+	out.precision(6);
+	out << "{\n";
+	out << "  \"width\": " << WIDTH << ", \"height\": " << HEIGHT << ",\n";
+	out << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ", \"simd\": \"" << simd << "\",\n";
+	out << "  \"warmup_frames\": " << warmup << ", \"timed_frames\": " << frames << ",\n";
+	out << "  \"results\": [\n";
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const bench_result &res = results[i];
+		std::vector<double> sorted = res.frame_ms;
+		std::sort(sorted.begin(), sorted.end());
+		size_t n = sorted.size();
+		double median = n % 2 ? sorted[n / 2] : 0.5 * (sorted[n / 2 - 1] + sorted[n / 2]);
+		double mean = 0, variance = 0;
+		for (double ms : sorted)
+			mean += ms / n;
+		for (double ms : sorted)
+			variance += (ms - mean) * (ms - mean) / std::max<size_t>(n - 1, 1);
+		double seconds = median / 1000;
+		// every shaded fragment resolves msaa covered samples
+		long long samples = res.fragments * res.msaa;
+
+		out << "    { \"workload\": \"" << res.workload << "\", \"shader\": \"" << res.shader << "\", \"msaa\": " << res.msaa
+			<< ", \"triangles\": " << res.triangles << ", \"fragments\": " << res.fragments << ", \"samples\": " << samples << ",\n";
+		out << "      \"ms\": { \"min\": " << sorted.front() << ", \"median\": " << median << ", \"mean\": " << mean
+			<< ", \"stddev\": " << std::sqrt(variance) << ", \"max\": " << sorted.back() << " },\n";
+		out << "      \"triangles_per_s\": " << res.triangles / seconds << ", \"msamples_per_s\": " << samples / seconds / 1e6
+			<< ", \"ns_per_fragment\": " << (res.fragments ? median * 1e6 / res.fragments : 0) << " }"
+			<< (i + 1 < results.size() ? ",\n" : "\n");
+
+		std::cout << res.workload << " " << res.shader << " " << res.msaa << "x: " << median << " ms\n";
+	}
+	out << "  ]\n}\n";
+}
+
+// Synthetic workloads with the interpolated color shader, the draw orders on forward shaded
+// layers, then the spot mesh with every shader, each at 1x and 4x MSAA
+void run_benchmarks(const std::shared_ptr<const rst::mesh_buffer> &spot_mesh, const uniform_block &uniforms,
+	const std::string &obj_path, const std::string &filename)
+{
+	const int warmup = 3, frames = 20;
+	const int msaa_modes[] = { 1, 4 };
+	const ShaderType shaders[] = { ShaderType::Normal, ShaderType::Phong, ShaderType::Texture, ShaderType::Bump, ShaderType::Displacement };
+	const char *shader_names[] = { "normal", "phong", "texture", "bump", "displacement" };
+
+	rst::rasterizer r(WIDTH, HEIGHT);
+	r.set_packed_output(true, rst::PixelOrder::BGRA);
+	r.set_tiled(true);
+	r.set_deferred_shading(true);
+	r.set_uniforms(uniforms);
+
+	std::vector<std::pair<std::string, rst::mesh_buffer>> synthetic;
+	synthetic.emplace_back("tiny_triangles", make_tiny_triangles(2));
+	synthetic.emplace_back("fullscreen_triangles", make_fullscreen_triangles(4, false));
+	synthetic.emplace_back("fullscreen_front_to_back", make_fullscreen_triangles(4, true));
+	synthetic.emplace_back("sliver_triangles", make_sliver_triangles(256));
+
+	std::vector<bench_result> results;
+	auto color_shader = [](const fragment_shader_payload &payload) { return payload.color; };
+	r.set_cull_mode(rst::CullMode::None);
+	r.set_model(Eigen::Matrix4f::Identity());
+	r.set_view(Eigen::Matrix4f::Identity());
+	r.set_projection(Eigen::Matrix4f::Identity());
+	for (auto &workload : synthetic)
+	{
+		long long triangles = workload.second.triangle_count();
+		auto mesh_id = r.load_mesh(std::move(workload.second));
+		for (int msaa : msaa_modes)
+		{
+			r.set_msaa(msaa);
+			results.push_back(run_bench_case(r, mesh_id, triangles, color_shader, warmup, frames));
+			results.back().workload = workload.first;
+			results.back().shader = "color";
+			results.back().msaa = msaa;
+		}
+	}
+
+	// back to front layers with forward shading: in submission order every layer is shaded,
+	// sorted per triangle or with a depth prepass only the nearest one
+	struct order_mode
+	{
+		const char *name;
+		rst::DrawOrder order;
+		bool prepass;
+	};
+	const order_mode order_modes[] = {
+		{ "forward_submission", rst::DrawOrder::Submission, false },
+		{ "forward_front_to_back", rst::DrawOrder::FrontToBack, false },
+		{ "forward_depth_prepass", rst::DrawOrder::Submission, true }
+	};
+	auto layers_id = r.load_mesh(make_fullscreen_triangles(4, false));
+	r.set_deferred_shading(false);
+	for (const order_mode &mode : order_modes)
+	{
+		r.set_draw_order(mode.order, 1);
+		r.set_depth_prepass(mode.prepass);
+		for (int msaa : msaa_modes)
+		{
+			r.set_msaa(msaa);
+			results.push_back(run_forward_bench_case(r, layers_id, 4, color_shader, warmup, frames));
+			results.back().workload = std::string("fullscreen_") + mode.name;
+			results.back().shader = "color";
+			results.back().msaa = msaa;
+		}
+	}
+	r.set_draw_order(rst::DrawOrder::Submission);
+	r.set_depth_prepass(false);
+	r.set_deferred_shading(true);
+
+	auto spot_texture = std::make_shared<Texture>(obj_path + "spot_texture.png");
+	auto height_map = load_height_map(obj_path + "hmap.jpg");
+	auto mesh_id = r.load_mesh(spot_mesh);
+	r.set_cull_mode(rst::CullMode::Back);
+	r.set_model(get_model_matrix(140));
+	r.set_view(get_view_matrix(uniforms.eye_pos));
+	r.set_projection(get_projection_matrix(45.0, 1, 0.1, 50));
+	for (int s = 0; s < 5; s++)
+	{
+		r.set_texture(shaders[s] == ShaderType::Texture ? spot_texture : height_map);
+		for (int msaa : msaa_modes)
+		{
+			r.set_msaa(msaa);
+			visit_fragment_shader(shaders[s], [&](const auto &frag_shader) {
+				results.push_back(run_bench_case(r, mesh_id, spot_mesh->triangle_count(), frag_shader, warmup, frames));
+			});
+			results.back().workload = "spot";
+			results.back().shader = shader_names[s];
+			results.back().msaa = msaa;
+		}
+	}
+
+	write_bench_json(results, warmup, frames, filename);
+}
+
+// Writes a synthetic OBJ of faces with the given number of corners: triangles and quads tile a
+// grid, larger polygons are separate star shaped n-gons with every other vertex pulled in.
+// Returns the face count.
+int write_loader_bench_obj(const std::string &path, int corners, int cells)
+{
+	std::ofstream out(path);
+	if (!out)
+		throw std::runtime_error("Cannot open " + path);
+	int faces = 0;
+	if (corners <= 4)
+	{
+		for (int y = 0; y <= cells; y++)
+			for (int x = 0; x <= cells; x++)
+				out << "v " << x * 0.01f << " " << y * 0.01f << " " << 0.001f * ((x * 7 + y * 3) % 5) << "\n";
+		auto id = [&](int x, int y) { return y * (cells + 1) + x + 1; };
+		for (int y = 0; y < cells; y++)
+		{
+			for (int x = 0; x < cells; x++)
 			{
-				t->setVertex(j, Eigen::Vector4f(mesh.Vertices[i + j].Position.X, mesh.Vertices[i + j].Position.Y, mesh.Vertices[i + j].Position.Z, 1.0));
-				t->setNormal(j, Eigen::Vector3f(mesh.Vertices[i + j].Normal.X, mesh.Vertices[i + j].Normal.Y, mesh.Vertices[i + j].Normal.Z));
-				t->setTexCoord(j, Eigen::Vector2f(mesh.Vertices[i + j].TextureCoordinate.X, mesh.Vertices[i + j].TextureCoordinate.Y));
+				if (corners == 4)
+				{
+					out << "f " << id(x, y) << " " << id(x + 1, y) << " " << id(x + 1, y + 1) << " " << id(x, y + 1) << "\n";
+					faces++;
+				}
+				else
+				{
+					out << "f " << id(x, y) << " " << id(x + 1, y) << " " << id(x + 1, y + 1) << "\n";
+					out << "f " << id(x, y) << " " << id(x + 1, y + 1) << " " << id(x, y + 1) << "\n";
+					faces += 2;
+				}
 			}
-			TriangleList.push_back(t);
 		}
+		return faces;
+	}
+
+	for (int c = 0; c < cells * cells; c++)
+	{
+		float cx = (c % cells) * 2.5f, cy = (c / cells) * 2.5f;
+		for (int k = 0; k < corners; k++)
+		{
+			float a = 2 * MY_PI * k / corners, radius = k % 2 ? 0.6f : 1.0f;
+			out << "v " << cx + radius * std::cos(a) << " " << cy + radius * std::sin(a) << " 0\n";
+		}
+		out << "f";
+		for (int k = 0; k < corners; k++)
+			out << " " << -corners + k;
+		out << "\n";
+		faces++;
+	}
+	return faces;
+}
+
+// Times objl::Loader::LoadFile on triangles, quads and n-gons, with the fast triangulation and with
+// the reference one, and writes faces per second as JSON
+void run_loader_benchmark(const std::string &filename)
+{
+	struct workload
+	{
+		const char *name;
+		int corners;
+		int cells;
+	};
+	const workload workloads[] = { { "triangles", 3, 300 }, { "quads", 4, 300 }, { "octagons", 8, 100 }, { "16-gons", 16, 60 } };
+	const int runs = 5;
+
+	std::ofstream out(filename);
+	if (!out)
+		throw std::runtime_error("Cannot open " + filename);
+	out.precision(6);
+	out << "{\n  \"hardware_threads\": " << std::thread::hardware_concurrency() << ", \"runs\": " << runs << ",\n";
+	out << "  \"results\": [\n";
+	for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++)
+	{
+		const workload &load = workloads[w];
+		std::string path = filename + "." + load.name + ".obj";
+		int faces = write_loader_bench_obj(path, load.corners, load.cells);
+		for (int reference = 0; reference < 2; reference++)
+		{
+			std::vector<double> ms;
+			size_t triangles = 0;
+			for (int i = 0; i < runs; i++)
+			{
+				objl::Loader loader;
+				loader.ReferenceTriangulation = reference != 0;
+				auto start = std::chrono::steady_clock::now();
+				loader.LoadFile(path);
+				ms.push_back(elapsed_ms(start));
+				triangles = loader.LoadedIndices.size() / 3;
+			}
+			std::sort(ms.begin(), ms.end());
+			double median = ms[runs / 2];
+			const char *triangulation = reference ? "reference" : "fast";
+
+			out << "    { \"workload\": \"" << load.name << "\", \"triangulation\": \"" << triangulation << "\", \"faces\": " << faces
+				<< ", \"triangles\": " << triangles << ", \"ms\": " << median << ", \"faces_per_s\": " << faces / (median / 1000) << " }"
+				<< (w + 1 < sizeof(workloads) / sizeof(workloads[0]) || !reference ? ",\n" : "\n");
+			std::cout << load.name << " " << triangulation << ": " << median << " ms, " << faces / (median / 1000) << " faces/s\n";
+		}
+		std::remove(path.c_str());
+	}
+	out << "  ]\n}\n";
+}
+
+// Headless turntable: renders the angles start, start + step, ... up to end with one rasterizer
+// per thread and writes <prefix>_<frame>.png. The mesh, texture and uniforms are shared read-only;
+// frames are encoded in parallel and written in order.
+void render_turntable(const std::shared_ptr<const rst::mesh_buffer> &mesh, const std::shared_ptr<Texture> &texture,
+	const uniform_block &uniforms, ShaderType shader, float start, float end, float step, const std::string &prefix)
+{
+	int frames = step > 0 ? (int)std::floor((end - start) / step + 1e-4f) + 1 : 1;
+	int threads = std::min(frames, std::max(1, (int)std::thread::hardware_concurrency()));
+
+	std::atomic<int> next_frame{ 0 };
+	int next_write = 0;
+	std::mutex mutex;
+	std::condition_variable written;
+
+	auto worker = [&]() {
+		// frames are the unit of parallelism, so each rasterizer runs single threaded
+		rst::rasterizer r(WIDTH, HEIGHT);
+		r.set_packed_output(true, rst::PixelOrder::BGRA);
+		r.set_deferred_shading(true);
+		r.set_cull_mode(rst::CullMode::Back);
+		auto mesh_id = r.load_mesh(mesh);
+		r.set_texture(texture);
+		r.set_uniforms(uniforms);
+		r.set_view(get_view_matrix(uniforms.eye_pos));
+		r.set_projection(get_projection_matrix(45.0, 1, 0.1, 50));
+
+		std::vector<uchar> png;
+		for (int f = next_frame++; f < frames; f = next_frame++)
+		{
+			r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+			r.set_model(get_model_matrix(start + f * step));
+			draw_mesh(r, mesh_id, shader);
+			cv::Mat image(HEIGHT, WIDTH, CV_8UC4, r.packed_frame_buffer().data());
+			cv::imencode(".png", image, png);
+
+			char name[32];
+			std::snprintf(name, sizeof(name), "_%04d.png", f);
+			std::unique_lock<std::mutex> lock(mutex);
+			written.wait(lock, [&] { return next_write == f; });
+			std::ofstream(prefix + name, std::ios::binary).write((const char *)png.data(), png.size());
+			std::cout << prefix + name << '\n';
+			next_write++;
+			written.notify_all();
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (int i = 1; i < threads; i++)
+		pool.emplace_back(worker);
+	worker();
+	for (auto &t : pool)
+		t.join();
+}
+
+int main(int argc, const char **argv)
+{
+	float angle = 140.0;
+	bool command_line = false;
+	bool texture_bench = false;
+	bool light_bench = false;
+	bool bench = false;
+	std::string filename = "output.png";
+	std::string obj_path = "../models/spot/";
+
+	// the loader benchmark writes its own models
+	if (argc == 3 && std::string(argv[2]) == "loader_bench")
+	{
+		std::cout << "Timing the OBJ loader, results go to " << argv[1] << "\n";
+		run_loader_benchmark(argv[1]);
+		return 0;
+	}
+
+	// Load .obj File, from its binary cache after the first run, with its triangles and vertices
+	// reordered for the vertex cache and overdraw
+	objl::MeshCache spot_obj;
+	bool loadout = spot_obj.LoadFile("../models/spot/spot_triangulated_good.obj", true);
+	if (!loadout)
+	{
+		std::cout << "Cannot load the spot model\n";
+		return 1;
+	}
+	rst::mesh_buffer spot;
+	spot.reserve(spot_obj.VertexCount, spot_obj.IndexCount / 3);
+	for (uint32_t i = 0; i < spot_obj.VertexCount; i++)
+	{
+		const objl::Vector3 &p = spot_obj.Positions[i], &n = spot_obj.Normals[i];
+		spot.positions.push_back(p.X, p.Y, p.Z);
+		spot.normals.push_back(n.X, n.Y, n.Z);
+		spot.texcoords.push_back(spot_obj.TextureCoordinates[i].X, spot_obj.TextureCoordinates[i].Y);
+		spot.colors.push_back(148, 121.0, 92.0);
+	}
+	spot.indices.assign(spot_obj.Indices, spot_obj.Indices + spot_obj.IndexCount);
+
+	rst::compute_tangents(spot);
+	// meshlets are cut along that order rather than regrown, so it is the order that is drawn
+	rst::build_meshlets(spot, 64, true);
+	{
+		std::vector<objl::Vertex> vertices(spot.vertex_count());
+		for (size_t i = 0; i < vertices.size(); i++)
+			vertices[i].Position = objl::Vector3(spot.positions.x[i], spot.positions.y[i], spot.positions.z[i]);
+		std::vector<unsigned int> indices(spot.indices.begin(), spot.indices.end());
+		// before optimizing, and on the indices as drawn
+		std::cout << "Vertex cache ACMR " << spot_obj.Optimization.AcmrBefore << " -> " << objl::algorithm::CacheMissRatio(indices, vertices.size())
+			<< ", overdraw " << spot_obj.Optimization.OverdrawBefore << " -> " << objl::algorithm::OverdrawRatio(vertices, indices) << "\n";
+	}
+	auto spot_mesh = std::make_shared<const rst::mesh_buffer>(std::move(spot));
+
+	Eigen::Vector3f eye_pos = { 0, 0, 10 };
+
+	uniform_block uniforms;
+	uniforms.lights = { light{ {20, 20, 20}, {500, 500, 500} }, light{ {-20, 20, 0}, {500, 500, 500} } };
+	uniforms.eye_pos = eye_pos;
+
+	// -b start end step [prefix] [shader]
+	if (argc >= 5 && std::string(argv[1]) == "-b")
+	{
+		ShaderType shader = shader_from_name(argc >= 7 ? argv[6] : "phong");
+		auto texture = shader == ShaderType::Texture ? std::make_shared<Texture>(obj_path + "spot_texture.png") : load_height_map(obj_path + "hmap.jpg");
+		render_turntable(spot_mesh, texture, uniforms, shader,
+			std::stof(argv[2]), std::stof(argv[3]), std::stof(argv[4]), argc >= 6 ? argv[5] : "output");
+		return 0;
 	}
 
-	std::function<Eigen::Vector3f(fragment_shader_payload)> active_shader = phong_fragment_shader;
+	ShaderType active_shader = ShaderType::Phong;
 
 	rst::rasterizer r(WIDTH, HEIGHT);
+	r.set_packed_output(true, rst::PixelOrder::BGRA);
+	r.set_tiled(true);
+	r.set_deferred_shading(true);
+	r.set_cull_mode(rst::CullMode::Back);
+
+	auto mesh_id = r.load_mesh(spot_mesh);
 	std::string texture_path = "hmap.jpg";
-	r.set_texture(std::make_shared<Texture>(obj_path + texture_path));
+	r.set_texture(load_height_map(obj_path + texture_path));
 
-	if (argc >= 2)
+	// -w [name]: interactive, also writing every shown frame to name
+	bool write_frames = false;
+	if (argc >= 2 && std::string(argv[1]) == "-w")
+	{
+		write_frames = true;
+		if (argc >= 3)
+			filename = std::string(argv[2]);
+	}
+	else if (argc >= 2)
 	{
 		command_line = true;
 		filename = std::string(argv[1]);
@@ -291,76 +864,194 @@ int main(int argc, const char **argv)
 		if (argc == 3 && std::string(argv[2]) == "texture")
 		{
 			std::cout << "Rasterizing using the texture shader\n";
-			active_shader = texture_fragment_shader;
+			active_shader = ShaderType::Texture;
 			texture_path = "spot_texture.png";
 			r.set_texture(std::make_shared<Texture>(obj_path + texture_path));
 		}
+		else if (argc == 3 && std::string(argv[2]) == "texture_bench")
+		{
+			std::cout << "Timing the texture shader with each texture filter\n";
+			active_shader = ShaderType::Texture;
+			texture_path = "spot_texture.png";
+			texture_bench = true;
+		}
+		else if (argc == 3 && std::string(argv[2]) == "light_bench")
+		{
+			std::cout << "Timing the phong shader against the number of lights\n";
+			active_shader = ShaderType::Phong;
+			light_bench = true;
+		}
+		else if (argc == 3 && std::string(argv[2]) == "bench")
+		{
+			std::cout << "Running the rasterizer benchmarks, results go to " << filename << "\n";
+			bench = true;
+		}
 		else if (argc == 3 && std::string(argv[2]) == "normal")
 		{
 			std::cout << "Rasterizing using the normal shader\n";
-			active_shader = normal_fragment_shader;
+			active_shader = ShaderType::Normal;
 		}
 		else if (argc == 3 && std::string(argv[2]) == "phong")
 		{
 			std::cout << "Rasterizing using the phong shader\n";
-			active_shader = phong_fragment_shader;
+			active_shader = ShaderType::Phong;
 		}
 		else if (argc == 3 && std::string(argv[2]) == "bump")
 		{
 			std::cout << "Rasterizing using the bump shader\n";
-			active_shader = bump_fragment_shader;
+			active_shader = ShaderType::Bump;
 		}
 		else if (argc == 3 && std::string(argv[2]) == "displacement")
 		{
 			std::cout << "Rasterizing using the bump shader\n";
-			active_shader = displacement_fragment_shader;
+			active_shader = ShaderType::Displacement;
 		}
 	}
 
-	
-	Eigen::Vector3f eye_pos = { 0, 0, 10 };
-
-	r.set_vertex_shader(vertex_shader);
-	r.set_fragment_shader(active_shader);
+	r.set_uniforms(uniforms);
 
 	int key = 0;
 	int frame_count = 0;
 
+	if (bench)
+	{
+		run_benchmarks(spot_mesh, uniforms, obj_path, filename);
+		return 0;
+	}
+
+	if (light_bench)
+	{
+		// lights on a ring above the model, the total intensity stays that of the two default lights
+		r.set_model(get_model_matrix(angle));
+		r.set_view(get_view_matrix(eye_pos));
+		r.set_projection(get_projection_matrix(45.0, 1, 0.1, 50));
+		const int frames = 12;
+		for (int count = 1; count <= 64; count *= 2)
+		{
+			uniforms.lights.clear();
+			for (int i = 0; i < count; i++)
+			{
+				float a = 2 * MY_PI * i / count;
+				float power = 1000.0f / count;
+				uniforms.lights.push_back(light{ {28 * std::cos(a), 20, 28 * std::sin(a)}, {power, power, power} });
+			}
+			r.set_uniforms(uniforms);
+			auto start = std::chrono::steady_clock::now();
+			for (int i = 0; i < frames; i++)
+			{
+				r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+				draw_mesh(r, mesh_id, active_shader);
+			}
+			std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+			std::cout << count << " lights: " << elapsed.count() / frames << " ms per frame\n";
+		}
+		return 0;
+	}
+
+	if (texture_bench)
+	{
+		// The baseline is the lookup the texture shader did before the tiled float layout and
+		// mipmapping: nearest, straight from the row-major cv::Mat with at<cv::Vec3b>
+		cv::Mat image_data = cv::imread(obj_path + texture_path);
+		cv::cvtColor(image_data, image_data, cv::COLOR_RGB2BGR);
+		auto mat_nearest_shader = [&image_data](const fragment_shader_payload &payload) {
+			float u = std::max(0.f, std::min(payload.tex_coords.x(), 0.99f));
+			float v = std::max(0.f, std::min(payload.tex_coords.y(), 0.99f));
+			auto color = image_data.at<cv::Vec3b>((int)((1 - v) * image_data.rows), (int)(u * image_data.cols));
+			return textured_phong(payload, Eigen::Vector3f(color[0], color[1], color[2]));
+		};
+		auto vs = [](const vertex_shader_payload &payload) { return vertex_shader(payload); };
+
+		const char *names[] = { "cv::Mat nearest (baseline)", "nearest", "bilinear", "trilinear" };
+		const TextureFilter filters[] = { TextureFilter::Nearest, TextureFilter::Nearest, TextureFilter::Bilinear, TextureFilter::Trilinear };
+		auto texture = std::make_shared<Texture>(obj_path + texture_path);
+		r.set_texture(texture);
+		r.set_view(get_view_matrix(eye_pos));
+		r.set_projection(get_projection_matrix(45.0, 1, 0.1, 50));
+		const int frames = 36;
+		for (int f = 0; f < 4; f++)
+		{
+			texture->set_filter(filters[f]);
+			auto start = std::chrono::steady_clock::now();
+			for (int i = 0; i < frames; i++)
+			{
+				r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+				r.set_model(get_model_matrix(angle + i * 10.0f));
+				if (f == 0)
+					r.draw(mesh_id, rst::Primitive::Triangle, vs, mat_nearest_shader);
+				else
+					draw_mesh(r, mesh_id, active_shader);
+			}
+			std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+			std::cout << names[f] << ": " << elapsed.count() / frames << " ms per frame\n";
+		}
+		return 0;
+	}
+
 	if (command_line)
 	{
 		r.clear(rst::Buffers::Color | rst::Buffers::Depth);
 		r.set_model(get_model_matrix(angle));
 		r.set_view(get_view_matrix(eye_pos));
 		r.set_projection(get_projection_matrix(45.0, 1, 0.1, 50));
+#if RST_ENABLE_STATS
+		r.set_heatmaps(true);
+#endif
 
-		r.draw(TriangleList);
-		cv::Mat image(700, 700, CV_32FC3, r.frame_buffer().data());
-		image.convertTo(image, CV_8UC3, 1.0f);
-		cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
+		draw_mesh(r, mesh_id, active_shader);
+		cv::Mat image(700, 700, CV_8UC4, r.packed_frame_buffer().data());
 
 		cv::imwrite(filename, image);
+#if RST_ENABLE_STATS
+		print_frame_stats(r.stats());
+		write_heatmap(r.overdraw_map(), sibling_filename(filename, "overdraw"));
+		write_heatmap(r.shade_cost_map(), sibling_filename(filename, "cost"));
+#endif
 
 		return 0;
 	}
 
 
-	while (key != 27)
-	{
+	// Double buffered: frame N + 1 renders on a worker thread while frame N is shown and,
+	// with -w, written by another one; the front buffer is only swapped back once its write is done
+	auto render = [&](float frame_angle) {
+		auto start = std::chrono::steady_clock::now();
 		r.clear(rst::Buffers::Color | rst::Buffers::Depth);
 
-		r.set_model(get_model_matrix(angle));
+		r.set_model(get_model_matrix(frame_angle));
 		r.set_view(get_view_matrix(eye_pos));
 		r.set_projection(get_projection_matrix(45.0, 1, 0.1, 50));
 
-		//r.draw(pos_id, ind_id, col_id, rst::Primitive::Triangle);
-		r.draw(TriangleList);
-		cv::Mat image(700, 700, CV_32FC3, r.frame_buffer().data());
-		image.convertTo(image, CV_8UC3, 1.0f);
-		cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
+		draw_mesh(r, mesh_id, active_shader);
+		return elapsed_ms(start);
+	};
+	auto write = [&](const unsigned char *pixels) {
+		auto start = std::chrono::steady_clock::now();
+		cv::imwrite(filename, cv::Mat(700, 700, CV_8UC4, (void *)pixels));
+		return elapsed_ms(start);
+	};
+	std::vector<unsigned char> front(r.packed_frame_buffer().size());
+	std::future<double> rendering = std::async(std::launch::async, render, angle);
+	std::future<double> writing;
 
+	while (key != 27)
+	{
+		auto frame_start = std::chrono::steady_clock::now();
+		double render_ms = rendering.get();
+		double write_ms = writing.valid() ? writing.get() : 0; // previous frame
+		std::swap(front, r.packed_frame_buffer());
+		rendering = std::async(std::launch::async, render, angle);
+		if (write_frames)
+			writing = std::async(std::launch::async, write, front.data());
+
+		auto display_start = std::chrono::steady_clock::now();
+		cv::Mat image(700, 700, CV_8UC4, front.data());
 		cv::imshow("image", image);
-		cv::imwrite(filename, image);
 		key = cv::waitKey(10);
+		double display_ms = elapsed_ms(display_start);
+
+		std::cout << "frame count: " << frame_count++ << ", render " << render_ms << " ms, display " << display_ms
+			<< " ms, write " << write_ms << " ms, frame " << elapsed_ms(frame_start) << " ms\n";
 
 		if (key == 'a')
 		{
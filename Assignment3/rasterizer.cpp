@@ -8,180 +8,682 @@ using namespace std;
 rst::rasterizer::rasterizer(int w, int h) : width(w), height(h)
 {
 	frame_buf.resize(w * h);
-	sample_buf.resize(4 * w * h);
-	depth_buf.resize(4 * w * h);
+	set_msaa(4);
 }
 
-rst::pos_buf_id rst::rasterizer::load_positions(const std::vector<Eigen::Vector3f> &positions)
+void rst::rasterizer::set_msaa(int samples)
 {
-	auto id = get_next_id();
-	pos_buf.emplace(id, positions);
+	if (!standard_sample_pattern(samples, pattern))
+		throw std::runtime_error("MSAA sample count must be 1, 2, 4, 8 or 16");
+	full_mask = (1u << samples) - 1;
+	pixel_color.assign(width * height, Eigen::Vector3f{ 0, 0, 0 });
+	pixel_mask.assign(width * height, (uint16_t)full_mask);
+	sample_buf.assign(samples * width * height, Eigen::Vector3f{ 0, 0, 0 });
+	depth_buf.assign(samples * width * height, std::numeric_limits<float>::infinity());
+	reset_hiz();
+}
 
-	return { id };
+static rst::vec3_stream to_stream(const std::vector<Eigen::Vector3f> &values)
+{
+	rst::vec3_stream stream;
+	stream.reserve(values.size());
+	for (const auto &v : values)
+		stream.push_back(v);
+	return stream;
 }
 
-rst::ind_buf_id rst::rasterizer::load_indices(const std::vector<Eigen::Vector3i> &indices)
+rst::pos_buf_id rst::rasterizer::load_positions(const std::vector<Eigen::Vector3f> &positions)
 {
-	auto id = get_next_id();
-	ind_buf.emplace(id, indices);
+	pos_buf.push_back(to_stream(positions));
+	return { (int)pos_buf.size() - 1 };
+}
 
-	return { id };
+rst::ind_buf_id rst::rasterizer::load_indices(const std::vector<Eigen::Vector3i> &indices)
+{
+	std::vector<int> flat;
+	flat.reserve(indices.size() * 3);
+	for (const auto &i : indices)
+	{
+		flat.push_back(i[0]);
+		flat.push_back(i[1]);
+		flat.push_back(i[2]);
+	}
+	ind_buf.push_back(std::move(flat));
+	return { (int)ind_buf.size() - 1 };
 }
 
 
 rst::col_buf_id rst::rasterizer::load_colors(const std::vector<Eigen::Vector3f> &colors)
 {
-	auto id = get_next_id();
-	col_buf.emplace(id, colors);
-
-	return { id };
+	col_buf.push_back(to_stream(colors));
+	return { (int)col_buf.size() - 1 };
 }
 
 rst::col_buf_id rst::rasterizer::load_normals(const std::vector<Eigen::Vector3f> &normals)
 {
-	auto id = get_next_id();
-	nor_buf.emplace(id, normals);
-	normal_id = id;
-	return { id };
+	nor_buf.push_back(to_stream(normals));
+	normal_id = (int)nor_buf.size() - 1;
+	return { normal_id };
+}
+
+rst::tex_buf_id rst::rasterizer::load_texcoords(const std::vector<Eigen::Vector2f> &texcoords)
+{
+	vec2_stream stream;
+	stream.reserve(texcoords.size());
+	for (const auto &t : texcoords)
+		stream.push_back(t);
+	tex_buf.push_back(std::move(stream));
+	texcoord_id = (int)tex_buf.size() - 1;
+	return { texcoord_id };
+}
+
+rst::mesh_buf_id rst::rasterizer::load_mesh(mesh_buffer mesh)
+{
+	return load_mesh(std::make_shared<const mesh_buffer>(std::move(mesh)));
+}
+
+rst::mesh_buf_id rst::rasterizer::load_mesh(std::shared_ptr<const mesh_buffer> mesh)
+{
+	std::array<Eigen::Vector3f, 2> bounds;
+	bounds[0] = Eigen::Vector3f::Constant(std::numeric_limits<float>::infinity());
+	bounds[1] = -bounds[0];
+	for (size_t i = 0; i < mesh->vertex_count(); i++)
+	{
+		bounds[0] = bounds[0].cwiseMin(mesh->positions[i]);
+		bounds[1] = bounds[1].cwiseMax(mesh->positions[i]);
+	}
+	mesh_bounds.push_back(bounds);
+	mesh_buf.push_back(std::move(mesh));
+	return { (int)mesh_buf.size() - 1 };
 }
 
 void rst::rasterizer::clear(rst::Buffers buff)
 {
 	if ((buff & rst::Buffers::Color) == rst::Buffers::Color)
 	{
-		std::fill(frame_buf.begin(), frame_buf.end(), Eigen::Vector3f{ 0, 0, 0 });
-		std::fill(sample_buf.begin(), sample_buf.end(), Eigen::Vector3f{ 0, 0, 0 });
+		if (packed)
+		{
+			for (int i = 0; i < width * height; i++)
+				pack_pixel(i, Eigen::Vector3f{ 0, 0, 0 });
+		}
+		else
+		{
+			std::fill(frame_buf.begin(), frame_buf.end(), Eigen::Vector3f{ 0, 0, 0 });
+		}
+		// sample_buf is only read for samples outside pixel_mask, so it needs no clearing
+		std::fill(pixel_color.begin(), pixel_color.end(), Eigen::Vector3f{ 0, 0, 0 });
+		std::fill(pixel_mask.begin(), pixel_mask.end(), (uint16_t)full_mask);
+		RST_STATS(
+			counters.reset();
+			std::fill(overdraw_buf.begin(), overdraw_buf.end(), 0.0f);
+			std::fill(shade_cost_buf.begin(), shade_cost_buf.end(), 0.0f);
+		)
 	}
 	if ((buff & rst::Buffers::Depth) == rst::Buffers::Depth)
 	{
 		std::fill(depth_buf.begin(), depth_buf.end(), std::numeric_limits<float>::infinity());
+		reset_hiz();
 	}
 }
 
+void rst::rasterizer::reset_hiz()
+{
+	hiz_blocks_x = (width + 7) / 8;
+	hiz_blocks_y = (height + 7) / 8;
+	hiz_tiles_x = (width + tile_size - 1) / tile_size;
+	hiz_tiles_y = (height + tile_size - 1) / tile_size;
+	hiz_block.assign(hiz ? hiz_blocks_x * hiz_blocks_y : 0, std::numeric_limits<float>::infinity());
+	hiz_pending.assign(hiz ? hiz_blocks_x * hiz_blocks_y : 0, 0);
+	hiz_tile.assign(hiz ? hiz_tiles_x * hiz_tiles_y : 0, std::numeric_limits<float>::infinity());
+}
 
-auto to_vec4(const Eigen::Vector3f &v3, float w)
+// Rescans the depth of every sample in the block
+void rst::rasterizer::update_hiz_block(int bx, int by)
 {
-	return Eigen::Vector4f(v3.x(), v3.y(), v3.z(), w);
+	float farthest = -std::numeric_limits<float>::infinity();
+	int x1 = min(bx * 8 + 8, width), y1 = min(by * 8 + 8, height);
+	for (int y = by * 8; y < y1; y++)
+	{
+		for (int x = bx * 8; x < x1; x++)
+		{
+			const float *depth = &depth_buf[get_index(x, y) * pattern.count];
+			for (int s = 0; s < pattern.count; s++)
+				farthest = max(farthest, depth[s]);
+		}
+	}
+	hiz_block[by * hiz_blocks_x + bx] = farthest;
+	hiz_pending[by * hiz_blocks_x + bx] = 0;
 }
-//
-//void rst::rasterizer::draw(pos_buf_id pos_buffer, ind_buf_id ind_buffer, col_buf_id col_buffer, Primitive type)
-//{
-//	auto &buf = pos_buf[pos_buffer.pos_id];
-//	auto &ind = ind_buf[ind_buffer.ind_id];
-//	auto &col = col_buf[col_buffer.col_id];
-//
-//	float f1 = (50 - 0.1) / 2.0;
-//	float f2 = (50 + 0.1) / 2.0;
-//
-//	Eigen::Matrix4f mvp = projection * view * model;
-//	for (auto &i : ind)
-//	{
-//		Triangle t;
-//		Eigen::Vector4f v[] = {
-//				mvp * to_vec4(buf[i[0]], 1.0f),
-//				mvp * to_vec4(buf[i[1]], 1.0f),
-//				mvp * to_vec4(buf[i[2]], 1.0f)
-//		};
-//		//Homogeneous division
-//		for (auto &vec : v)
-//		{
-//			vec /= vec.w();
-//		}
-//		//Viewport transformation
-//		for (auto &vert : v)
-//		{
-//			vert.x() = 0.5 * width * (vert.x() + 1.0);
-//			vert.y() = 0.5 * height * (vert.y() + 1.0);
-//			vert.z() = vert.z() * f1 + f2;
-//		}
-//
-//		for (int i = 0; i < 3; ++i)
-//		{
-//			t.setVertex(i, v[i].head<3>());
-//			t.setVertex(i, v[i].head<3>());
-//			t.setVertex(i, v[i].head<3>());
-//		}
-//
-//		Eigen::Vector3f col_x = col[i[0]];
-//		Eigen::Vector3f col_y = col[i[1]];
-//		Eigen::Vector3f col_z = col[i[2]];
-//
-//		t.setColor(0, col_x[0], col_x[1], col_x[2]);
-//		t.setColor(1, col_y[0], col_y[1], col_y[2]);
-//		t.setColor(2, col_z[0], col_z[1], col_z[2]);
-//
-//		rasterize_triangle(t);
-//	}
-//}
 
+// Recomputes the tiles overlapping the pixel rectangle [x0, x1] x [y0, y1] from their blocks
+void rst::rasterizer::update_hiz_tiles(int x0, int y0, int x1, int y1)
+{
+	int tile_blocks = tile_size / 8;
+	for (int ty = y0 / tile_size; ty <= y1 / tile_size; ty++)
+	{
+		for (int tx = x0 / tile_size; tx <= x1 / tile_size; tx++)
+		{
+			float farthest = -std::numeric_limits<float>::infinity();
+			int bx1 = min((tx + 1) * tile_blocks, hiz_blocks_x), by1 = min((ty + 1) * tile_blocks, hiz_blocks_y);
+			for (int by = ty * tile_blocks; by < by1; by++)
+				for (int bx = tx * tile_blocks; bx < bx1; bx++)
+					farthest = max(farthest, hiz_block[by * hiz_blocks_x + bx]);
+			hiz_tile[ty * hiz_tiles_x + tx] = farthest;
+		}
+	}
+}
 
-void rst::rasterizer::draw(const std::vector<Triangle *> &TriangleList)
+// True when nothing at depth min_z or farther can pass the depth test anywhere in the pixel
+// rectangle [x0, x1] x [y0, y1]: tiles are checked first, blocks only inside tiles that do not
+// reject on their own.
+bool rst::rasterizer::hiz_rejects(float min_z, int x0, int y0, int x1, int y1) const
 {
+	int tile_blocks = tile_size / 8;
+	for (int ty = y0 / tile_size; ty <= y1 / tile_size; ty++)
+	{
+		for (int tx = x0 / tile_size; tx <= x1 / tile_size; tx++)
+		{
+			if (min_z >= hiz_tile[ty * hiz_tiles_x + tx])
+				continue;
+			int bx0 = max(tx * tile_blocks, x0 / 8), bx1 = min((tx + 1) * tile_blocks - 1, x1 / 8);
+			int by0 = max(ty * tile_blocks, y0 / 8), by1 = min((ty + 1) * tile_blocks - 1, y1 / 8);
+			for (int by = by0; by <= by1; by++)
+				for (int bx = bx0; bx <= bx1; bx++)
+					if (min_z < hiz_block[by * hiz_blocks_x + bx])
+						return false;
+		}
+	}
+	return true;
+}
+
+bool rst::rasterizer::occluded(const Eigen::Vector3f &box_min, const Eigen::Vector3f &box_max)
+{
+	if (!hiz)
+		return false;
+	RST_STATS(stats_counters::add(counters.occlusion_queries, 1);)
+
+	// screen space bounds of the corners, with the viewport transform of assemble_triangle
+	Eigen::Matrix4f mvp = projection * view * model;
 	float f1 = (50 - 0.1) / 2.0;
 	float f2 = (50 + 0.1) / 2.0;
+	Eigen::Vector3f lo = Eigen::Vector3f::Constant(std::numeric_limits<float>::infinity());
+	Eigen::Vector3f hi = -lo;
+	for (int c = 0; c < 8; c++)
+	{
+		Eigen::Vector4f corner(c & 1 ? box_max.x() : box_min.x(), c & 2 ? box_max.y() : box_min.y(), c & 4 ? box_max.z() : box_min.z(), 1.0f);
+		Eigen::Vector4f clip = mvp * corner;
+		if (clip.w() <= 0 || clip.z() < -clip.w())
+			return false;
+		Eigen::Vector3f screen(0.5f * width * (clip.x() / clip.w() + 1.0f), 0.5f * height * (clip.y() / clip.w() + 1.0f), clip.z() / clip.w() * f1 + f2);
+		lo = lo.cwiseMin(screen);
+		hi = hi.cwiseMax(screen);
+	}
+
+	int x0 = max((int)std::floor(lo.x()), 0), x1 = min((int)hi.x(), width - 1);
+	int y0 = max((int)std::floor(lo.y()), 0), y1 = min((int)hi.y(), height - 1);
+	bool result = x0 > x1 || y0 > y1 || hiz_rejects(lo.z(), x0, y0, x1, y1);
+	RST_STATS(
+		if (result)
+			stats_counters::add(counters.objects_occluded, 1);
+	)
+	return result;
+}
+
+bool rst::rasterizer::occluded(mesh_buf_id mesh_handle)
+{
+	const std::array<Eigen::Vector3f, 2> &bounds = mesh_bounds[mesh_handle.mesh_id];
+	return occluded(bounds[0], bounds[1]);
+}
+
+
+auto to_vec4(const Eigen::Vector3f &v3, float w)
+{
+	return Eigen::Vector4f(v3.x(), v3.y(), v3.z(), w);
+}
+
+
+void rst::rasterizer::draw(pos_buf_id pos_buffer, ind_buf_id ind_buffer, col_buf_id col_buffer, Primitive type)
+{
+	if (type != Primitive::Triangle)
+	{
+		throw std::runtime_error("Drawing primitives other than triangle is not implemented yet!");
+	}
+
+	draw_indexed(pos_buf[pos_buffer.pos_id], ind_buf[ind_buffer.ind_id], &col_buf[col_buffer.col_id],
+		normal_id >= 0 ? &nor_buf[normal_id] : nullptr, nullptr, texcoord_id >= 0 ? &tex_buf[texcoord_id] : nullptr);
+}
+
+void rst::rasterizer::draw(mesh_buf_id mesh_handle, Primitive type)
+{
+	if (type != Primitive::Triangle)
+	{
+		throw std::runtime_error("Drawing primitives other than triangle is not implemented yet!");
+	}
+
+	const mesh_buffer &mesh = *mesh_buf[mesh_handle.mesh_id];
+	draw_indexed(mesh.positions, mesh.indices, &mesh.colors, mesh.normals.empty() ? nullptr : &mesh.normals,
+		mesh.tangents.empty() ? nullptr : &mesh.tangents, mesh.texcoords.empty() ? nullptr : &mesh.texcoords, &mesh.meshlets);
+}
+
+void rst::rasterizer::draw_indexed(const vec3_stream &pos, const std::vector<int> &ind, const vec3_stream *col, const vec3_stream *nor,
+	const vec3_stream *tan, const vec2_stream *tex, const std::vector<meshlet> *meshlets)
+{
+	if (vertex_batch_shader)
+		transform_vertices(pos, col, nor, tan, tex, [this](vertex_batch &b) { vertex_batch_shader(b); });
+	else if (vertex_shader)
+		transform_vertices(pos, col, nor, tan, tex, make_per_vertex_shader(vertex_shader));
+	else
+		transform_vertices(pos, col, nor, tan, tex, identity_vertex_shader());
+	assemble_indexed(ind, meshlets);
+	rasterize_post_tris();
+}
+
+void rst::rasterizer::set_heatmaps(bool enable)
+{
+	// the heatmap buffers only exist in RST_ENABLE_STATS builds
+#if RST_ENABLE_STATS
+	heatmaps = enable;
+	overdraw_buf.assign(heatmaps ? width * height : 0, 0.0f);
+	shade_cost_buf.assign(heatmaps ? width * height : 0, 0.0f);
+#else
+	(void)enable;
+#endif
+}
 
+// True when the bounding sphere lies entirely outside one of the planes
+static bool sphere_outside(const Eigen::Vector4f *planes, const rst::meshlet &m)
+{
+	for (int i = 0; i < 6; i++)
+		if (planes[i].head<3>().dot(m.center) + planes[i].w() < -m.radius)
+			return true;
+	return false;
+}
+
+// True when dot(p - eye, n) > 0 for every point p of the bounding sphere and every unit n within the
+// cone around axis: at worst it is |d| cos(theta + alpha) - radius, with d = center - eye and theta
+// the angle between d and axis
+static bool cone_faces_away(const rst::meshlet &m, const Eigen::Vector3f &eye, const Eigen::Vector3f &axis)
+{
+	if (m.cone_cos <= 0)
+		return false;
+	Eigen::Vector3f d = m.center - eye;
+	float cone_sin = std::sqrt(1 - m.cone_cos * m.cone_cos);
+	return d.dot(axis) * m.cone_cos - d.cross(axis).norm() * cone_sin > m.radius;
+}
+
+void rst::rasterizer::assemble_indexed(const std::vector<int> &ind, const std::vector<meshlet> *meshlets)
+{
+	RST_STATS(stats_clock::time_point start = stats_clock::now();)
+	post_tris.clear();
+	post_view_pos.clear();
+	post_tex_grad.clear();
+	auto assemble_range = [&](size_t first, size_t last) {
+		for (size_t i = first; i + 2 < last; i += 3)
+		{
+			clip_vertex cv[3] = { vertex_cache[ind[i]], vertex_cache[ind[i + 1]], vertex_cache[ind[i + 2]] };
+			assemble_triangle(cv);
+		}
+	};
+	if (!meshlet_culling || !meshlets || meshlets->empty())
+	{
+		assemble_range(0, ind.size());
+		RST_STATS(counters.add_time(Stage::Setup, start);)
+		return;
+	}
+
+	// Meshlet bounds are tested in model space. The frustum planes are sums of mvp rows. For the
+	// normal cones, with A the x, y and w rows of the mvp restricted to xyz and the eye the point
+	// they map to zero, a triangle is counter-clockwise on screen exactly when
+	// det(A) * dot(p - eye, n) > 0. A parallel projection has no such eye and skips the cone test.
 	Eigen::Matrix4f mvp = projection * view * model;
+	Eigen::Vector4f planes[6];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		planes[2 * axis] = (mvp.row(3) + mvp.row(axis)).transpose();
+		planes[2 * axis + 1] = (mvp.row(3) - mvp.row(axis)).transpose();
+	}
+	for (auto &plane : planes)
+		plane /= plane.head<3>().norm();
+	Eigen::Matrix3f a;
+	a << mvp.block<2, 3>(0, 0), mvp.block<1, 3>(3, 0);
+	float det = a.determinant();
+	bool cone_test = cull_mode != CullMode::None && det != 0;
+	Eigen::Vector3f eye = Eigen::Vector3f::Zero();
+	if (cone_test)
+		eye = -a.inverse() * Eigen::Vector3f(mvp(0, 3), mvp(1, 3), mvp(3, 3));
+	cone_test = cone_test && eye.allFinite();
+	// flips a cone axis toward the side culled by cull_mode
+	float culled_side = (det > 0) == (cull_mode == CullMode::Back) ? -1.0f : 1.0f;
+
+	RST_STATS(long long frustum_culled = 0; long long backface_culled = 0;)
+	for (const meshlet &m : *meshlets)
+	{
+		if (sphere_outside(planes, m))
+		{
+			RST_STATS(frustum_culled++;)
+			continue;
+		}
+		if (cone_test && cone_faces_away(m, eye, culled_side * m.cone_axis))
+		{
+			RST_STATS(backface_culled++;)
+			continue;
+		}
+		assemble_range(m.first_index, m.first_index + 3 * (size_t)m.triangle_count);
+	}
+	RST_STATS(
+		stats_counters::add(counters.meshlets_tested, meshlets->size());
+		stats_counters::add(counters.meshlets_frustum_culled, frustum_culled);
+		stats_counters::add(counters.meshlets_backface_culled, backface_culled);
+		counters.add_time(Stage::Setup, start);
+	)
+}
+
+void rst::rasterizer::draw(const std::vector<Triangle *> &TriangleList)
+{
+	// vertex transform and assembly are interleaved here, so both count as setup
+	RST_STATS(stats_clock::time_point start = stats_clock::now();)
+	post_tris.clear();
+	post_view_pos.clear();
+	post_tex_grad.clear();
+
+	Eigen::Matrix4f mv = view * model;
+	Eigen::Matrix4f mvp = projection * mv;
+	Eigen::Matrix4f inv_trans = mv.inverse().transpose();
 	for (const auto &t : TriangleList)
 	{
-		Triangle newtri(*t);
+		clip_vertex cv[3];
+		for (int i = 0; i < 3; i++)
+		{
+			cv[i].pos = mvp * t->v[i];
+			cv[i].view_pos = (mv * t->v[i]).head<3>();
+			cv[i].normal = (inv_trans * to_vec4(t->normal[i], 0.0f)).head<3>();
+			cv[i].tangent = (mv * to_vec4(t->tangent[i], 0.0f)).head<3>();
+			cv[i].tex_coords = t->tex_coords[i];
+			cv[i].color = Eigen::Vector3f(148 / 255., 121 / 255., 92 / 255.);
+		}
+		assemble_triangle(cv);
+	}
+	RST_STATS(counters.add_time(Stage::Setup, start);)
 
-		std::vector<Eigen::Vector4f> mm{
-				(view * model * t->v[0]),
-				(view * model * t->v[1]),
-				(view * model * t->v[2])
-		};
+	rasterize_post_tris();
+}
 
-		std::vector<Eigen::Vector3f> viewspace_pos(3);
+// Fills draw_list with the order in which post_tris are rasterized
+void rst::rasterizer::sort_post_tris()
+{
+	int count = (int)post_tris.size();
+	draw_list.resize(count);
+	for (int ti = 0; ti < count; ti++)
+		draw_list[ti] = ti;
+	if (draw_order == DrawOrder::Submission)
+		return;
 
-		std::transform(mm.begin(), mm.end(), viewspace_pos.begin(), [](auto &v) {return v.head<3>(); });
+	// clusters are ordered by their nearest vertex; ties keep submission order
+	RST_STATS(stats_clock::time_point start = stats_clock::now();)
+	int clusters = (count + sort_cluster - 1) / sort_cluster;
+	std::vector<std::pair<float, int>> keys(clusters);
+	for (int c = 0; c < clusters; c++)
+	{
+		float nearest = std::numeric_limits<float>::infinity();
+		for (int ti = c * sort_cluster; ti < min(count, (c + 1) * sort_cluster); ti++)
+			for (int k = 0; k < 3; k++)
+				nearest = min(nearest, post_tris[ti].v[k].z());
+		keys[c] = { nearest, c };
+	}
+	std::sort(keys.begin(), keys.end());
+	int n = 0;
+	for (const auto &key : keys)
+		for (int ti = key.second * sort_cluster; ti < min(count, (key.second + 1) * sort_cluster); ti++)
+			draw_list[n++] = ti;
+	RST_STATS(counters.add_time(Stage::Setup, start);)
+}
 
-		Eigen::Vector4f v[] = {
-				mvp * t->v[0],
-				mvp * t->v[1],
-				mvp * t->v[2]
-		};
-		//Homogeneous division
-		for (auto &vec : v)
+void rst::rasterizer::rasterize_post_tris()
+{
+	if (deferred)
+	{
+		rasterize_visibility([this](const screen_rect &rect) { shade_visible(rect, fragment_shader); });
+		return;
+	}
+
+	sort_post_tris();
+	visibility_pass = false;
+	auto rasterize_all = [this] {
+		if (tiled)
 		{
-			vec.x() /= vec.w();
-			vec.y() /= vec.w();
-			vec.z() /= vec.w();
+			draw_tiled(nullptr);
+			return;
 		}
+		screen_rect full{ 0, 0, width, height };
+		for (int ti : draw_list)
+			rasterize_triangle(ti, full);
+	};
 
-		Eigen::Matrix4f inv_trans = (view * model).inverse().transpose();
-		Eigen::Vector4f n[] = {
-				inv_trans * to_vec4(t->normal[0], 0.0f),
-				inv_trans * to_vec4(t->normal[1], 0.0f),
-				inv_trans * to_vec4(t->normal[2], 0.0f)
-		};
+	if (depth_prepass)
+	{
+		depth_only_pass = true;
+		rasterize_all();
+		depth_only_pass = false;
+		depth_equal_pass = true;
+		rasterize_all();
+		depth_equal_pass = false;
+		return;
+	}
+	rasterize_all();
+}
 
-		//Viewport transformation
-		for (auto &vert : v)
+void rst::rasterizer::rasterize_visibility(const std::function<void(const screen_rect &)> &shade_rect)
+{
+	sort_post_tris();
+	visibility_pass = true;
+	vis_buf.resize(width * height);
+	std::fill(vis_buf.begin(), vis_buf.end(), visibility{ -1, 0, 0, 0 });
+
+	if (tiled)
+	{
+		draw_tiled(shade_rect);
+		return;
+	}
+
+	screen_rect full{ 0, 0, width, height };
+	for (int ti : draw_list)
+		rasterize_triangle(ti, full);
+	shade_rect(full);
+}
+
+static rst::clip_vertex lerp(const rst::clip_vertex &a, const rst::clip_vertex &b, float t)
+{
+	rst::clip_vertex r;
+	r.pos = a.pos + t * (b.pos - a.pos);
+	r.view_pos = a.view_pos + t * (b.view_pos - a.view_pos);
+	r.normal = a.normal + t * (b.normal - a.normal);
+	r.tangent = a.tangent + t * (b.tangent - a.tangent);
+	r.tex_coords = a.tex_coords + t * (b.tex_coords - a.tex_coords);
+	r.color = a.color + t * (b.color - a.color);
+	return r;
+}
+
+// Sutherland-Hodgman against one clip space plane, keeps the part where plane.dot(pos) >= 0
+static int clip_polygon(const rst::clip_vertex *in, int n, rst::clip_vertex *out, const Eigen::Vector4f &plane)
+{
+	int m = 0;
+	for (int i = 0; i < n; i++)
+	{
+		const rst::clip_vertex &a = in[i];
+		const rst::clip_vertex &b = in[(i + 1) % n];
+		float da = plane.dot(a.pos);
+		float db = plane.dot(b.pos);
+		if (da >= 0)
+			out[m++] = a;
+		if ((da >= 0) != (db >= 0))
+			out[m++] = lerp(a, b, da / (da - db));
+	}
+	return m;
+}
+
+// Attributes are interpolated linearly in screen space, so their derivatives are per triangle
+static std::array<Eigen::Vector2f, 2> tex_gradients(const Triangle &t)
+{
+	Eigen::Vector2f e1 = (t.v[1] - t.v[0]).head<2>();
+	Eigen::Vector2f e2 = (t.v[2] - t.v[0]).head<2>();
+	Eigen::Vector2f t1 = t.tex_coords[1] - t.tex_coords[0];
+	Eigen::Vector2f t2 = t.tex_coords[2] - t.tex_coords[0];
+	float det = e1.x() * e2.y() - e1.y() * e2.x();
+	if (det == 0)
+		return { { Eigen::Vector2f::Zero(), Eigen::Vector2f::Zero() } };
+	float inv = 1.0f / det;
+	return { { (t1 * e2.y() - t2 * e1.y()) * inv, (t2 * e1.x() - t1 * e2.x()) * inv } };
+}
+
+// Primitive assembly: frustum rejection, near plane and guard-band clipping in homogeneous
+// space, then perspective division, viewport transform and face culling. Surviving triangles
+// are appended to post_tris; a clipped triangle becomes a fan of up to 6 triangles.
+void rst::rasterizer::assemble_triangle(const clip_vertex *cv)
+{
+	RST_STATS(stats_counters::add(counters.triangles_submitted, 1);)
+	// trivially reject triangles entirely outside one frustum plane
+	for (int axis = 0; axis < 3; axis++)
+	{
+		bool outside = cv[0].pos[axis] > cv[0].pos.w() && cv[1].pos[axis] > cv[1].pos.w() && cv[2].pos[axis] > cv[2].pos.w();
+		outside = outside || (cv[0].pos[axis] < -cv[0].pos.w() && cv[1].pos[axis] < -cv[1].pos.w() && cv[2].pos[axis] < -cv[2].pos.w());
+		if (outside)
 		{
-			vert.x() = 0.5 * width * (vert.x() + 1.0);
-			vert.y() = 0.5 * height * (vert.y() + 1.0);
-			vert.z() = vert.z() * f1 + f2;
+			RST_STATS(stats_counters::add(counters.triangles_culled, 1);)
+			return;
 		}
+	}
+
+	// only clip against the guard band when a vertex leaves it; inside it the
+	// rasterizer's scissor to the screen rectangle is cheaper than clipping
+	bool need_clip = false;
+	for (int i = 0; i < 3; i++)
+	{
+		const Eigen::Vector4f &p = cv[i].pos;
+		if (p.z() < -p.w() || std::abs(p.x()) > guard_band * p.w() || std::abs(p.y()) > guard_band * p.w())
+			need_clip = true;
+	}
 
-		for (int i = 0; i < 3; ++i)
+	clip_vertex poly[2][8];
+	int n = 3;
+	std::copy(cv, cv + 3, poly[0]);
+	int cur = 0;
+	if (need_clip)
+	{
+		RST_STATS(stats_counters::add(counters.triangles_clipped, 1);)
+		const Eigen::Vector4f planes[] = {
+				{ 0, 0, 1, 1 }, // near: z >= -w
+				{ 1, 0, 0, guard_band },
+				{ -1, 0, 0, guard_band },
+				{ 0, 1, 0, guard_band },
+				{ 0, -1, 0, guard_band }
+		};
+		for (const auto &plane : planes)
 		{
-			//screen space coordinates
-			newtri.setVertex(i, v[i]);
+			n = clip_polygon(poly[cur], n, poly[1 - cur], plane);
+			cur = 1 - cur;
+			if (n < 3)
+			{
+				RST_STATS(stats_counters::add(counters.triangles_culled, 1);)
+				return;
+			}
 		}
+	}
 
-		for (int i = 0; i < 3; ++i)
+	float f1 = (50 - 0.1) / 2.0;
+	float f2 = (50 + 0.1) / 2.0;
+
+	Eigen::Vector4f screen[8];
+	for (int i = 0; i < n; i++)
+	{
+		Eigen::Vector4f vec = poly[cur][i].pos;
+		//Homogeneous division
+		vec.x() /= vec.w();
+		vec.y() /= vec.w();
+		vec.z() /= vec.w();
+		//Viewport transformation
+		vec.x() = 0.5 * width * (vec.x() + 1.0);
+		vec.y() = 0.5 * height * (vec.y() + 1.0);
+		vec.z() = vec.z() * f1 + f2;
+		screen[i] = vec;
+	}
+
+	for (int i = 1; i + 1 < n; i++)
+	{
+		const int idx[3] = { 0, i, i + 1 };
+		if (cull_mode != CullMode::None)
+		{
+			// counter-clockwise on screen is front facing
+			const Eigen::Vector4f &a = screen[idx[0]], &b = screen[idx[1]], &c = screen[idx[2]];
+			float area = (b.x() - a.x()) * (c.y() - a.y()) - (c.x() - a.x()) * (b.y() - a.y());
+			if (cull_mode == CullMode::Back ? area <= 0 : area >= 0)
+			{
+				RST_STATS(stats_counters::add(counters.triangles_culled, 1);)
+				continue;
+			}
+		}
+
+		Triangle newtri;
+		std::array<Eigen::Vector3f, 3> view_pos;
+		for (int k = 0; k < 3; k++)
 		{
+			const clip_vertex &v = poly[cur][idx[k]];
+			//screen space coordinates
+			newtri.setVertex(k, screen[idx[k]]);
 			//view space normal
-			newtri.setNormal(i, n[i].head<3>());
+			newtri.setNormal(k, v.normal);
+			newtri.setTangent(k, v.tangent);
+			newtri.setTexCoord(k, v.tex_coords);
+			newtri.color[k] = v.color;
+			view_pos[k] = v.view_pos;
 		}
+		post_tris.push_back(newtri);
+		post_view_pos.push_back(view_pos);
+		post_tex_grad.push_back(tex_gradients(newtri));
+	}
+}
+
+// shade_rect, when set, runs on each tile right after the tile is rasterized
+void rst::rasterizer::draw_tiled(const std::function<void(const screen_rect &)> &shade_rect)
+{
+	if (!pool)
+		pool.reset(new ThreadPool());
 
-		newtri.setColor(0, 148, 121.0, 92.0);
-		newtri.setColor(1, 148, 121.0, 92.0);
-		newtri.setColor(2, 148, 121.0, 92.0);
+	int tiles_x = (width + tile_size - 1) / tile_size;
+	int tiles_y = (height + tile_size - 1) / tile_size;
+	tile_bins.resize(tiles_x * tiles_y);
+	for (auto &bin : tile_bins)
+		bin.clear();
 
-		// Also pass view space vertice position
-		rasterize_triangle(newtri, viewspace_pos);
+	// binning keeps the draw_list order inside every tile, so each pixel sees
+	// the same sequence of depth tests as in the serial path
+	for (int ti : draw_list)
+	{
+		const Eigen::Vector4f *v = post_tris[ti].v;
+		int min_x = min(min(v[0].x(), v[1].x()), v[2].x());
+		int max_x = max(max(v[0].x(), v[1].x()), v[2].x());
+		int min_y = min(min(v[0].y(), v[1].y()), v[2].y());
+		int max_y = max(max(v[0].y(), v[1].y()), v[2].y());
+		if (max_x < 0 || max_y < 0 || min_x >= width || min_y >= height)
+			continue;
+		int tx0 = max(min_x, 0) / tile_size;
+		int tx1 = min(max_x, width - 1) / tile_size;
+		int ty0 = max(min_y, 0) / tile_size;
+		int ty1 = min(max_y, height - 1) / tile_size;
+		for (int ty = ty0; ty <= ty1; ty++)
+			for (int tx = tx0; tx <= tx1; tx++)
+				tile_bins[ty * tiles_x + tx].push_back(ti);
 	}
+
+	// a tile only writes the color, sample and depth buffers inside its own rectangle
+	pool->parallel_for(tiles_x * tiles_y, [&](int tile) {
+		int tx = tile % tiles_x;
+		int ty = tile / tiles_x;
+		screen_rect rect{ tx * tile_size, ty * tile_size, min((tx + 1) * tile_size, width), min((ty + 1) * tile_size, height) };
+		for (int ti : tile_bins[tile])
+			rasterize_triangle(ti, rect);
+		if (shade_rect)
+			shade_rect(rect);
+	});
 }
 
 static bool insideTriangle(float x, float y, const vector<Eigen::Vector3f> &v)
@@ -206,8 +708,213 @@ static std::tuple<float, float, float> computeBarycentric2D(float x, float y, co
 }
 
 
-void rst::rasterizer::rasterize_triangle(const Triangle &t, const vector<Eigen::Vector3f> &viewspace_pos)
+void rst::rasterizer::rasterize_triangle(int ti, const screen_rect &rect)
+{
+	RST_STATS(stats_clock::time_point start = stats_clock::now();)
+	if (raster_mode == RasterMode::Scalar)
+		rasterize_triangle_scalar(ti, rect);
+	else
+		rasterize_triangle_simd(ti, rect);
+	RST_STATS(counters.add_time(Stage::Raster, start);)
+}
+
+// Edge equations are set up once per triangle; coverage and barycentrics are then
+// evaluated for 8 pixels of a row at a time, without any heap allocation.
+void rst::rasterizer::rasterize_triangle_simd(int ti, const screen_rect &rect)
+{
+	const Triangle &t = post_tris[ti];
+	const Eigen::Vector4f *v = t.v;
+	edge_equations e;
+	if (!setup_edges(v, e))
+		return;
+
+	int min_x = min(min(v[0].x(), v[1].x()), v[2].x());
+	int max_x = max(max(v[0].x(), v[1].x()), v[2].x());
+	int min_y = min(min(v[0].y(), v[1].y()), v[2].y());
+	int max_y = max(max(v[0].y(), v[1].y()), v[2].y());
+	min_x = max(min_x, rect.x0);
+	max_x = min(max_x, rect.x1 - 1);
+	min_y = max(min_y, rect.y0);
+	max_y = min(max_y, rect.y1 - 1);
+
+	float inv_w[3] = { 1.0f / v[0].w(), 1.0f / v[1].w(), 1.0f / v[2].w() };
+	float z_w[3] = { v[0].z() * inv_w[0], v[1].z() * inv_w[1], v[2].z() * inv_w[2] };
+	// depth is taken at the pixel center, which can lie outside a partly covered triangle;
+	// clamping to the vertex depths keeps it inside the range the hierarchical z test assumes
+	float min_z = min(min(v[0].z(), v[1].z()), v[2].z());
+	float max_z = max(max(v[0].z(), v[1].z()), v[2].z());
+	// after a depth prepass a sample exactly at the stored depth still passes
+	float reject_z = depth_equal_pass ? std::nextafter(min_z, -std::numeric_limits<float>::infinity()) : min_z;
+	if (hiz && min_x <= max_x && min_y <= max_y && hiz_rejects(reject_z, min_x, min_y, max_x, max_y))
+	{
+		RST_STATS(stats_counters::add(counters.triangles_hiz_culled, 1);)
+		return;
+	}
+
+	// walks the 8x8 blocks of the bounding box so each block is tested and updated once
+	RST_STATS(long long pixels_tested = 0; long long depth_passes = 0; long long blocks_culled = 0;)
+	bool any_changed = false;
+	raster_block block;
+	for (int by = min_y >> 3; by <= max_y >> 3; by++)
+	{
+		for (int bx = min_x >> 3; bx <= max_x >> 3; bx++)
+		{
+			if (hiz && reject_z >= hiz_block[by * hiz_blocks_x + bx])
+			{
+				RST_STATS(blocks_culled++;)
+				continue;
+			}
+			int x = bx * 8;
+			int first_lane = max(min_x - x, 0);
+			int last_lane = min(max_x - x, 7);
+			int pixels_written = 0;
+			int pixels_full = 0;
+			for (int y = max(by * 8, min_y); y <= min(by * 8 + 7, max_y); y++)
+			{
+				eval_block8(e, x, y, pattern.x, pattern.y, pattern.count, block);
+				RST_STATS(pixels_tested += last_lane - first_lane + 1;)
+				for (int l = first_lane; l <= last_lane; l++)
+				{
+					unsigned mask = block.coverage[l];
+					if (mask == 0)
+						continue;
+					pixels_full += mask == full_mask;
+					float alpha = block.alpha[l];
+					float beta = block.beta[l];
+					float gamma = block.gamma[l];
+					float Z = 1.0f / (alpha * inv_w[0] + beta * inv_w[1] + gamma * inv_w[2]);
+					float zp = (alpha * z_w[0] + beta * z_w[1] + gamma * z_w[2]) * Z;
+					zp = min(max(zp, min_z), max_z);
+					int pix = get_index(x + l, y);
+					if (depth_only_pass)
+					{
+						unsigned written = test_depth(pix, mask, zp);
+						RST_STATS(depth_passes += count_bits(written);)
+						pixels_written += written != 0;
+						continue;
+					}
+					Eigen::Vector3f color = alpha * t.color[0] + beta * t.color[1] + gamma * t.color[2];
+					unsigned written = write_samples(pix, mask, zp, color);
+					RST_STATS(depth_passes += count_bits(written);)
+					if (written)
+					{
+						pixels_written++;
+						emit_pixel(x + l, y, pix, alpha, beta, gamma, ti);
+					}
+				}
+			}
+			// the shading pass after a depth prepass leaves the depth buffer as it is
+			if (!hiz || depth_equal_pass)
+				continue;
+			// every sample of a fully covered block now lies at max_z or nearer, which is
+			// free to record; partial writes are folded in by a rescan once about a block's
+			// worth of pixels has changed
+			int b = by * hiz_blocks_x + bx;
+			if (pixels_full == 64 && max_z < hiz_block[b])
+			{
+				hiz_block[b] = max_z;
+				hiz_pending[b] = 0;
+				any_changed = true;
+			}
+			else if (pixels_written > 0 && (hiz_pending[b] += pixels_written) >= 64)
+			{
+				update_hiz_block(bx, by);
+				any_changed = true;
+			}
+		}
+	}
+	if (any_changed)
+		update_hiz_tiles(min_x, min_y, max_x, max_y);
+	RST_STATS(
+		stats_counters::add(counters.blocks_hiz_culled, blocks_culled);
+		stats_counters::add(counters.pixels_tested, pixels_tested);
+		stats_counters::add(counters.samples_tested, pixels_tested * pattern.count);
+		stats_counters::add(counters.depth_passes, depth_passes);
+	)
+}
+
+// Forward shading runs the fragment shader as soon as a pixel gains a sample; deferred shading
+// only records the triangle and barycentrics, and shade_visible runs the shader once per pixel.
+void rst::rasterizer::emit_pixel(int x, int y, int pix, float alpha, float beta, float gamma, int ti)
+{
+	if (visibility_pass)
+		vis_buf[pix] = visibility{ ti, alpha, beta, gamma };
+	else
+		shade_pixel(x, y, pix, alpha, beta, gamma, ti, fragment_shader);
+}
+
+// Depth tests the covered samples of a pixel and stores zp for those that pass. In the shading
+// pass after a depth prepass the depth buffer is final and a sample passes when zp equals it.
+// Returns the mask of passing samples.
+unsigned rst::rasterizer::test_depth(int pix, unsigned covered, float zp)
+{
+	float *depth = &depth_buf[pix * pattern.count];
+	unsigned written = 0;
+	if (depth_equal_pass)
+	{
+		for (int s = 0; s < pattern.count; s++)
+			if ((covered >> s) & 1u && zp <= depth[s])
+				written |= 1u << s;
+		return written;
+	}
+	for (int s = 0; s < pattern.count; s++)
+	{
+		if ((covered >> s) & 1u && zp < depth[s])
+		{
+			depth[s] = zp;
+			written |= 1u << s;
+		}
+	}
+	return written;
+}
+
+// Depth tests the covered samples of a pixel and stores color for those that pass.
+// Returns the mask of written samples.
+unsigned rst::rasterizer::write_samples(int pix, unsigned covered, float zp, const Eigen::Vector3f &color)
 {
+	int base = pix * pattern.count;
+	unsigned written = test_depth(pix, covered, zp);
+	if (written == 0)
+		return 0;
+	RST_STATS(
+		if (heatmaps)
+			overdraw_buf[pix] += 1;
+	)
+
+	unsigned mask = pixel_mask[pix];
+	if ((mask & ~written) == 0)
+	{
+		// every sample still using pixel_color is overwritten, so it can take the new color
+		pixel_color[pix] = color;
+		pixel_mask[pix] = (uint16_t)written;
+	}
+	else
+	{
+		for (int s = 0; s < pattern.count; s++)
+			if ((written >> s) & 1u)
+				sample_buf[base + s] = color;
+		pixel_mask[pix] = (uint16_t)(mask & ~written);
+	}
+	return written;
+}
+
+Eigen::Vector3f rst::rasterizer::resolve_pixel(int pix) const
+{
+	unsigned mask = pixel_mask[pix];
+	if (mask == full_mask)
+		return pixel_color[pix];
+	int base = pix * pattern.count;
+	Eigen::Vector3f color = (float)count_bits(mask) * pixel_color[pix];
+	for (int s = 0; s < pattern.count; s++)
+		if (!((mask >> s) & 1u))
+			color += sample_buf[base + s];
+	return color / (float)pattern.count;
+}
+
+void rst::rasterizer::rasterize_triangle_scalar(int ti, const screen_rect &rect)
+{
+	const Triangle &t = post_tris[ti];
+
 	// TODO: From your HW3, get the triangle rasterization code.
 	// TODO: Inside your rasterization loop:
 	//    * v[i].w() is the vertex view space depth value z.
@@ -234,60 +941,108 @@ void rst::rasterizer::rasterize_triangle(const Triangle &t, const vector<Eigen::
 	int max_x = max(max(v[0].x(), v[1].x()), v[2].x());
 	int min_y = min(min(v[0].y(), v[1].y()), v[2].y());
 	int max_y = max(max(v[0].y(), v[1].y()), v[2].y());
+	min_x = max(min_x, rect.x0);
+	max_x = min(max_x, rect.x1 - 1);
+	min_y = max(min_y, rect.y0);
+	max_y = min(max_y, rect.y1 - 1);
+	float min_z = min(min(v[0].z(), v[1].z()), v[2].z());
+	float max_z = max(max(v[0].z(), v[1].z()), v[2].z());
+	float reject_z = depth_equal_pass ? std::nextafter(min_z, -std::numeric_limits<float>::infinity()) : min_z;
+	if (hiz && min_x <= max_x && min_y <= max_y && hiz_rejects(reject_z, min_x, min_y, max_x, max_y))
+	{
+		RST_STATS(stats_counters::add(counters.triangles_hiz_culled, 1);)
+		return;
+	}
+	RST_STATS(long long pixels_tested = 0; long long depth_passes = 0;)
+	bool any_written = false;
 	for (int x = min_x; x <= max_x; x++)
 	{
 		for (int y = min_y; y <= max_y; y++)
 		{
-			int ind = get_index(x, y) * 4;
+			RST_STATS(pixels_tested++;)
+			int pix = get_index(x, y);
 			auto tup = computeBarycentric2D(x + 0.5, y + 0.5, t.toVector3());
 			float alpha = get<0>(tup);
 			float beta = get<1>(tup);
 			float gamma = get<2>(tup);
 			//sample
-			float x_offset[] = { 0.25, 0.75, 0.75, 0.25 };
-			float y_offset[] = { 0.25, 0.25, 0.75, 0.75 };
-			int num_samples = 4;
-			int cnt = 0;
-			for (int i = 0; i < 4; i++)
+			unsigned mask = 0;
+			for (int i = 0; i < pattern.count; i++)
 			{
-				if (insideTriangle(x + x_offset[i], y + y_offset[i], t.toVector3()))
-				{
-					float Z = 1.0 / (alpha / v[0].w() + beta / v[1].w() + gamma / v[2].w());
-					float zp = alpha * v[0].z() / v[0].w() + beta * v[1].z() / v[1].w() + gamma * v[2].z() / v[2].w();
-					zp *= Z;
-					Eigen::Vector3f color = alpha * t.color[0] + beta * t.color[1] + gamma * t.color[2];
-					if (zp < depth_buf[ind + i])
-					{
-						cnt++;
-						depth_buf[ind + i] = zp;
-						sample_buf[ind + i] = color;
-					}
-				}
+				if (insideTriangle(x + pattern.x[i], y + pattern.y[i], t.toVector3()))
+					mask |= 1u << i;
 			}
-			if (cnt > 0)
+			if (mask == 0)
+				continue;
+			float Z = 1.0 / (alpha / v[0].w() + beta / v[1].w() + gamma / v[2].w());
+			float zp = alpha * v[0].z() / v[0].w() + beta * v[1].z() / v[1].w() + gamma * v[2].z() / v[2].w();
+			zp *= Z;
+			zp = min(max(zp, min_z), max_z);
+			if (depth_only_pass)
 			{
-				Eigen::Vector3f color = { 0,0,0 };
-				for (int i = 0; i < 4; i++)
-				{
-					color += sample_buf[ind + i];
-				}
-				color /= 4.0f;
-				Eigen::Vector3f interpolated_normal = alpha * t.normal[0] + beta * t.normal[1] + gamma * t.normal[2];
-				Eigen::Vector2f interpolated_texcoords = alpha * t.tex_coords[0] + beta * t.tex_coords[1] + gamma * t.tex_coords[2];
-				fragment_shader_payload payload(color, interpolated_normal.normalized(), interpolated_texcoords, texture);
-				Eigen::Vector3f interpolated_shadingcoords = alpha * viewspace_pos[0] + beta * viewspace_pos[1] + gamma * viewspace_pos[2];
-				payload.view_pos = interpolated_shadingcoords;
-				set_pixel(x, y, fragment_shader(payload));
+				unsigned written = test_depth(pix, mask, zp);
+				RST_STATS(depth_passes += count_bits(written);)
+				any_written = any_written || written;
+				continue;
+			}
+			Eigen::Vector3f color = alpha * t.color[0] + beta * t.color[1] + gamma * t.color[2];
+			unsigned written = write_samples(pix, mask, zp, color);
+			RST_STATS(depth_passes += count_bits(written);)
+			if (written)
+			{
+				any_written = true;
+				emit_pixel(x, y, pix, alpha, beta, gamma, ti);
 			}
 		}
 	}
+	if (hiz && any_written && !depth_equal_pass)
+	{
+		for (int by = min_y >> 3; by <= max_y >> 3; by++)
+			for (int bx = min_x >> 3; bx <= max_x >> 3; bx++)
+				update_hiz_block(bx, by);
+		update_hiz_tiles(min_x, min_y, max_x, max_y);
+	}
+	RST_STATS(
+		stats_counters::add(counters.pixels_tested, pixels_tested);
+		stats_counters::add(counters.samples_tested, pixels_tested * pattern.count);
+		stats_counters::add(counters.depth_passes, depth_passes);
+	)
 }
 
 void rst::rasterizer::set_pixel(int x, int y, const Eigen::Vector3f &color)
 {
 	if (x < 0 || x >= width || y < 0 || y >= height) return;
 
-	frame_buf[get_index(x, y)] = color * 255.0f;
+	if (packed)
+		pack_pixel(get_index(x, y), color * 255.0f);
+	else
+		frame_buf[get_index(x, y)] = color * 255.0f;
+}
+
+void rst::rasterizer::set_packed_output(bool enable, PixelOrder order)
+{
+	packed = enable;
+	red_offset = order == PixelOrder::RGBA ? 0 : 2;
+	blue_offset = 2 - red_offset;
+	packed_buf.assign(enable ? 4 * width * height : 0, 0);
+}
+
+// rounds and saturates like cv::Mat::convertTo to CV_8U
+static unsigned char to_unorm8(float v)
+{
+	v += 0.5f;
+	if (!(v > 0))
+		return 0;
+	return v >= 255 ? 255 : (unsigned char)v;
+}
+
+void rst::rasterizer::pack_pixel(int ind, const Eigen::Vector3f &color)
+{
+	unsigned char *p = &packed_buf[ind * 4];
+	p[red_offset] = to_unorm8(color.x());
+	p[1] = to_unorm8(color.y());
+	p[blue_offset] = to_unorm8(color.z());
+	p[3] = 255;
 }
 
 int rst::rasterizer::get_index(int x, int y)
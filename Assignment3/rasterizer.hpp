@@ -2,8 +2,17 @@
 
 #include <eigen3/Eigen/Eigen>
 #include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
 #include "Triangle.hpp"
 #include "Shader.hpp"
+#include "ThreadPool.hpp"
+#include "EdgeFunction.hpp"
+#include "MeshBuffer.hpp"
+#include "VertexBatch.hpp"
+#include "FrameStats.hpp"
 
 namespace rst
 {
@@ -29,6 +38,20 @@ namespace rst
 		Triangle
 	};
 
+	// byte order of a pixel in the packed 8-bit frame buffer
+	enum class PixelOrder
+	{
+		RGBA,
+		BGRA
+	};
+
+	// Scalar is the original per-sample insideTriangle/computeBarycentric2D loop, kept for A/B timing
+	enum class RasterMode
+	{
+		Scalar,
+		EdgeSimd
+	};
+
 	/*
 	 * For the curious : The draw function takes two buffer id's as its arguments.
 	 * These two structs make sure that if you mix up with their orders, the
@@ -49,6 +72,49 @@ namespace rst
 		int col_id = 0;
 	};
 
+	struct tex_buf_id
+	{
+		int tex_id = 0;
+	};
+
+	// pixel rectangle [x0, x1) x [y0, y1) that a triangle is allowed to touch
+	struct screen_rect
+	{
+		int x0, y0, x1, y1;
+	};
+
+	enum class CullMode
+	{
+		None,
+		Back,
+		Front
+	};
+
+	// order in which the triangles of a draw reach the raster stage
+	enum class DrawOrder
+	{
+		Submission,
+		FrontToBack
+	};
+
+	// vertex after the vertex stage, before clipping
+	struct clip_vertex
+	{
+		Eigen::Vector4f pos; // clip space
+		Eigen::Vector3f view_pos;
+		Eigen::Vector3f normal; // view space
+		Eigen::Vector3f tangent; // view space
+		Eigen::Vector2f tex_coords;
+		Eigen::Vector3f color;
+	};
+
+	// visibility buffer entry: the last triangle that won a sample of the pixel
+	struct visibility
+	{
+		int tri;
+		float alpha, beta, gamma;
+	};
+
 	class rasterizer
 	{
 	public:
@@ -57,27 +123,136 @@ namespace rst
 		ind_buf_id load_indices(const std::vector<Eigen::Vector3i> &indices);
 		col_buf_id load_colors(const std::vector<Eigen::Vector3f> &colors);
 		col_buf_id load_normals(const std::vector<Eigen::Vector3f> &normals);
+		tex_buf_id load_texcoords(const std::vector<Eigen::Vector2f> &texcoords);
+		mesh_buf_id load_mesh(mesh_buffer mesh);
+		// shares the mesh instead of copying it, e.g. between rasterizers rendering on different threads
+		mesh_buf_id load_mesh(std::shared_ptr<const mesh_buffer> mesh);
+
+		// Occlusion query against the hierarchical depth buffer with the current matrices: true
+		// when no point of the box can pass the depth test, including boxes entirely off screen.
+		// Conservative, boxes crossing the near plane are never occluded.
+		bool occluded(const Eigen::Vector3f &box_min, const Eigen::Vector3f &box_max);
+		// the same for the bounding box of a loaded mesh
+		bool occluded(mesh_buf_id mesh_handle);
 
 		void set_model(const Eigen::Matrix4f &m) { model = m; }
 		void set_view(const Eigen::Matrix4f &v) { view = v; }
 		void set_projection(const Eigen::Matrix4f &p) { projection = p; }
 		void set_texture(std::shared_ptr<Texture> tex) { texture = tex; }
+		// copied once here, every fragment of the following draws reads the same block
+		void set_uniforms(const uniform_block &block) { uniforms = block; }
+		const uniform_block &get_uniforms() const { return uniforms; }
+
+		// Shaders for the std::function draw calls. The templated draw below is the fast path.
+		void set_vertex_shader(std::function<Eigen::Vector3f(const vertex_shader_payload &)> vert_shader) { vertex_shader = vert_shader; }
+		// Runs on 8 vertices at a time and may rewrite any attribute; takes precedence over
+		// set_vertex_shader. In tiled mode batches run on several threads, so it must be reentrant.
+		void set_vertex_batch_shader(std::function<void(vertex_batch &)> batch_shader) { vertex_batch_shader = batch_shader; }
+		void set_fragment_shader(std::function<Eigen::Vector3f(const fragment_shader_payload &)> frag_shader) { fragment_shader = frag_shader; }
 
-		void set_vertex_shader(std::function<Eigen::Vector3f(vertex_shader_payload)> vert_shader) { vertex_shader = vert_shader; }
-		void set_fragment_shader(std::function<Eigen::Vector3f(fragment_shader_payload)> frag_shader) { fragment_shader = frag_shader; }
+		// Sort-middle mode: triangles are binned into tile_size x tile_size screen tiles after
+		// vertex processing and the tiles are rasterized in parallel. Output is identical to the serial path.
+		// The tile size is rounded up to a multiple of 8 so tiles hold whole hierarchical z blocks.
+		void set_tiled(bool enable, int size = 64)
+		{
+			tiled = enable;
+			tile_size = std::max(8, (size + 7) / 8 * 8);
+			reset_hiz();
+		}
+		void set_threads(int num_threads) { pool.reset(new ThreadPool(num_threads)); }
+		void set_raster_mode(RasterMode mode) { raster_mode = mode; }
+		// Two-pass mode: rasterize depth, triangle id and barycentrics into a visibility buffer,
+		// then run the fragment shader exactly once per visible pixel at the end of draw.
+		void set_deferred_shading(bool enable) { deferred = enable; }
+		void set_cull_mode(CullMode mode) { cull_mode = mode; }
+		// triangles reaching further than guard_band * w outside the view volume are clipped
+		void set_guard_band(float band) { guard_band = std::max(1.0f, band); }
+		// FrontToBack cuts overdraw: the triangles of every draw are cut into clusters of cluster_size
+		// consecutive triangles, which keep their order, and the clusters are rasterized nearest
+		// first. Depth only changes where two triangles are exactly equally deep, but a pixel shared
+		// by several triangles can end up with the shaded color of another one of them.
+		void set_draw_order(DrawOrder order, int cluster_size = 32)
+		{
+			draw_order = order;
+			sort_cluster = std::max(1, cluster_size);
+		}
+		// Forward shading only: a depth-only pass over the whole draw fills the depth buffer first,
+		// then the shading pass runs the fragment shader only where a sample's depth equals the final
+		// one, so a pixel is shaded once per triangle visible in it. The visibility buffer paths
+		// already shade once per pixel and do not use it.
+		void set_depth_prepass(bool enable) { depth_prepass = enable; }
+		// Meshes with meshlets are culled a meshlet at a time against the frustum and, with back or
+		// front face culling, by their normal cones, before their triangles are assembled. On by default.
+		void set_meshlet_culling(bool enable) { meshlet_culling = enable; }
+		// Hierarchical z: keeps the farthest depth of every 8x8 pixel block and of every tile and
+		// skips triangles and blocks that lie behind it. On by default; the image is unchanged.
+		void set_hierarchical_z(bool enable) { hiz = enable; reset_hiz(); }
+		// 1, 2, 4, 8 or 16 samples per pixel on the standard sample patterns; reallocates and clears all buffers
+		void set_msaa(int samples);
 
 		void clear(Buffers buff);
 
-		//void draw(pos_buf_id pos_buffer, ind_buf_id ind_buffer, col_buf_id col_buffer, Primitive type);
+		// Indexed draw; uses the most recently loaded normal and texcoord buffers. Colors are 0-255,
+		// vertices without a color get the default spot color.
+		void draw(pos_buf_id pos_buffer, ind_buf_id ind_buffer, col_buf_id col_buffer, Primitive type);
+		void draw(mesh_buf_id mesh_handle, Primitive type);
+		// Compile-time shader pipeline: the shaders are template parameters and inline into the
+		// vertex loop and the per-pixel shading loop. Pixels are always shaded from the visibility
+		// buffer, once per visible pixel, whatever set_deferred_shading says.
+		template <typename VertexShader, typename FragmentShader>
+		void draw(mesh_buf_id mesh_handle, Primitive type, const VertexShader &vert_shader, const FragmentShader &frag_shader);
 		void draw(const std::vector<Triangle *> &TriangleList);
 		void set_pixel(int x, int y, const Eigen::Vector3f &color);
 		int get_index(int x, int y);
 
 		std::vector<Eigen::Vector3f> &frame_buffer() { return frame_buf; }
+		// Packed mode: set_pixel rounds to 8 bits and writes straight into packed_frame_buffer(),
+		// 4 bytes per pixel in the given order with alpha 255; frame_buffer() is left untouched.
+		// The buffer can be wrapped in a CV_8UC4 cv::Mat without copying.
+		void set_packed_output(bool enable, PixelOrder order = PixelOrder::BGRA);
+		std::vector<unsigned char> &packed_frame_buffer() { return packed_buf; }
+
+		// Work counters and stage timings since the last color clear. All zero unless the
+		// rasterizer is built with RST_ENABLE_STATS=1.
+		frame_stats stats() const { return counters.snapshot(); }
+		// Per-pixel overdraw (pixel writes that passed the depth test) and shading time in
+		// microseconds, in frame_buffer() order. Only filled in RST_ENABLE_STATS builds.
+		void set_heatmaps(bool enable);
+		const std::vector<float> &overdraw_map() const { return overdraw_buf; }
+		const std::vector<float> &shade_cost_map() const { return shade_cost_buf; }
 
 	private:
-		void rasterize_triangle(const Triangle &t, const std::vector<Eigen::Vector3f> &viewspace_pos);
-		// VERTEX SHADER -> MVP -> Clipping -> /.W -> VIEWPORT -> DRAWLINE/DRAWTRI -> FRAGSHADER
+		void pack_pixel(int ind, const Eigen::Vector3f &color);
+		void draw_indexed(const vec3_stream &pos, const std::vector<int> &ind, const vec3_stream *col, const vec3_stream *nor,
+			const vec3_stream *tan, const vec2_stream *tex, const std::vector<meshlet> *meshlets = nullptr);
+		// vertex stage: runs batch_shader on batches of 8 vertices, then transforms them 8 wide
+		template <typename BatchShader>
+		void transform_vertices(const vec3_stream &pos, const vec3_stream *col, const vec3_stream *nor, const vec3_stream *tan,
+			const vec2_stream *tex, const BatchShader &batch_shader);
+		// assembles every triangle, or only those of the meshlets that survive culling
+		void assemble_indexed(const std::vector<int> &ind, const std::vector<meshlet> *meshlets = nullptr);
+		void assemble_triangle(const clip_vertex *cv);
+		void sort_post_tris();
+		void rasterize_post_tris();
+		// rasterizes post_tris into the visibility buffer, then calls shade_rect on every screen region
+		void rasterize_visibility(const std::function<void(const screen_rect &)> &shade_rect);
+		void rasterize_triangle(int ti, const screen_rect &rect);
+		void rasterize_triangle_scalar(int ti, const screen_rect &rect);
+		void rasterize_triangle_simd(int ti, const screen_rect &rect);
+		unsigned test_depth(int pix, unsigned covered, float zp);
+		unsigned write_samples(int pix, unsigned covered, float zp, const Eigen::Vector3f &color);
+		void reset_hiz();
+		void update_hiz_block(int bx, int by);
+		void update_hiz_tiles(int x0, int y0, int x1, int y1);
+		bool hiz_rejects(float min_z, int x0, int y0, int x1, int y1) const;
+		Eigen::Vector3f resolve_pixel(int pix) const;
+		void emit_pixel(int x, int y, int pix, float alpha, float beta, float gamma, int ti);
+		template <typename FragmentShader>
+		void shade_pixel(int x, int y, int pix, float alpha, float beta, float gamma, int ti, const FragmentShader &frag_shader);
+		template <typename FragmentShader>
+		void shade_visible(const screen_rect &rect, const FragmentShader &frag_shader);
+		void draw_tiled(const std::function<void(const screen_rect &)> &shade_rect);
+		// VERTEX SHADER -> MVP -> Clipping -> /.W -> VIEWPORT -> CULLING -> DRAWLINE/DRAWTRI -> FRAGSHADER
 
 	private:
 		int width, height;
@@ -85,23 +260,205 @@ namespace rst
 		Eigen::Matrix4f view;
 		Eigen::Matrix4f projection;
 
-		std::map<int, std::vector<Eigen::Vector3f>> pos_buf;
-		std::map<int, std::vector<Eigen::Vector3i>> ind_buf;
-		std::map<int, std::vector<Eigen::Vector3f>> col_buf;
-		std::map<int, std::vector<Eigen::Vector3f>> nor_buf;
+		// dense buffer tables, a buffer id is the index into its table
+		std::vector<vec3_stream> pos_buf;
+		std::vector<std::vector<int>> ind_buf;
+		std::vector<vec3_stream> col_buf;
+		std::vector<vec3_stream> nor_buf;
+		std::vector<vec2_stream> tex_buf;
+		std::vector<std::shared_ptr<const mesh_buffer>> mesh_buf;
+		std::vector<std::array<Eigen::Vector3f, 2>> mesh_bounds; // model space min and max corner
 		int normal_id = -1;
+		int texcoord_id = -1;
+		std::vector<clip_vertex> vertex_cache;
 
 		std::vector<Eigen::Vector3f> frame_buf;
+		std::vector<unsigned char> packed_buf;
+		bool packed = false;
+		int red_offset = 2, blue_offset = 0;
+		// Compressed MSAA color: every sample whose bit is set in pixel_mask uses pixel_color,
+		// the others live in sample_buf. Fully covered pixels never touch sample_buf.
+		sample_pattern pattern;
+		unsigned full_mask;
+		std::vector<Eigen::Vector3f> pixel_color;
+		std::vector<uint16_t> pixel_mask;
 		std::vector<Eigen::Vector3f> sample_buf;
-		std::vector<float> depth_buf;
+		std::vector<float> depth_buf; // one depth per sample
+		std::vector<visibility> vis_buf;
+
+		// hierarchical z, pixel rectangles indexed with y up like the raster loops; infinity
+		// means nothing is known. Both levels only shrink until the next depth clear.
+		bool hiz = true;
+		int hiz_blocks_x = 0, hiz_blocks_y = 0;
+		int hiz_tiles_x = 0, hiz_tiles_y = 0;
+		std::vector<float> hiz_block; // farthest sample depth of each 8x8 block, or an upper bound
+		std::vector<uint16_t> hiz_pending; // pixels written since the block was last rescanned
+		std::vector<float> hiz_tile;  // farthest block depth of each tile_size x tile_size tile
+
+		// screen space triangles and their view space positions, produced by the vertex stage of draw
+		std::vector<Triangle> post_tris;
+		std::vector<std::array<Eigen::Vector3f, 3>> post_view_pos;
+		// d(tex_coords)/dx and d(tex_coords)/dy, constant over a triangle
+		std::vector<std::array<Eigen::Vector2f, 2>> post_tex_grad;
+		// indices into post_tris in the order they are rasterized
+		std::vector<int> draw_list;
 
 		std::shared_ptr<Texture> texture;
+		uniform_block uniforms;
 
-		std::function<Eigen::Vector3f(fragment_shader_payload)> fragment_shader;
-		std::function<Eigen::Vector3f(vertex_shader_payload)> vertex_shader;
-		
+		std::function<Eigen::Vector3f(const fragment_shader_payload &)> fragment_shader;
+		std::function<Eigen::Vector3f(const vertex_shader_payload &)> vertex_shader;
+		std::function<void(vertex_batch &)> vertex_batch_shader;
 
-		int next_id = 0;
-		int get_next_id() { return next_id++; }
+		RasterMode raster_mode = RasterMode::EdgeSimd;
+		bool deferred = false;
+		bool visibility_pass = false; // set while rasterizing into vis_buf
+		DrawOrder draw_order = DrawOrder::Submission;
+		int sort_cluster = 32;
+		bool depth_prepass = false;
+		bool depth_only_pass = false;  // set during the depth prepass
+		bool depth_equal_pass = false; // set during the shading pass after it
+		CullMode cull_mode = CullMode::None;
+		bool meshlet_culling = true;
+		float guard_band = 4.0f;
+		bool tiled = false;
+		int tile_size = 64;
+		std::unique_ptr<ThreadPool> pool;
+		std::vector<std::vector<int>> tile_bins;
+
+		stats_counters counters;
+		bool heatmaps = false;
+		std::vector<float> overdraw_buf;
+		std::vector<float> shade_cost_buf;
 	};
+
+	template <typename VertexShader, typename FragmentShader>
+	void rasterizer::draw(mesh_buf_id mesh_handle, Primitive type, const VertexShader &vert_shader, const FragmentShader &frag_shader)
+	{
+		if (type != Primitive::Triangle)
+		{
+			throw std::runtime_error("Drawing primitives other than triangle is not implemented yet!");
+		}
+
+		const mesh_buffer &mesh = *mesh_buf[mesh_handle.mesh_id];
+		transform_vertices(mesh.positions, &mesh.colors, mesh.normals.empty() ? nullptr : &mesh.normals,
+			mesh.tangents.empty() ? nullptr : &mesh.tangents, mesh.texcoords.empty() ? nullptr : &mesh.texcoords, make_per_vertex_shader(vert_shader));
+		assemble_indexed(mesh.indices, &mesh.meshlets);
+		rasterize_visibility([&](const screen_rect &rect) { shade_visible(rect, frag_shader); });
+	}
+
+	template <typename BatchShader>
+	void rasterizer::transform_vertices(const vec3_stream &pos, const vec3_stream *col, const vec3_stream *nor, const vec3_stream *tan,
+		const vec2_stream *tex, const BatchShader &batch_shader)
+	{
+		// matrices are computed once per draw and flattened to rows: 4 of the MVP for clip space,
+		// 3 of the model-view for view space, 3 of its inverse transpose for normals and 3 of
+		// the model-view without translation for tangents
+		Eigen::Matrix4f mv = view * model;
+		Eigen::Matrix4f mvp = projection * mv;
+		Eigen::Matrix4f inv_trans = mv.inverse().transpose();
+		float rows[13][4];
+		for (int c = 0; c < 4; c++)
+		{
+			for (int r = 0; r < 4; r++)
+				rows[r][c] = mvp(r, c);
+			for (int r = 0; r < 3; r++)
+			{
+				rows[4 + r][c] = mv(r, c);
+				rows[7 + r][c] = c < 3 ? inv_trans(r, c) : 0.0f;
+				rows[10 + r][c] = c < 3 ? mv(r, c) : 0.0f;
+			}
+		}
+
+		// post-transform cache: every vertex of the buffer is transformed exactly once,
+		// triangles are then assembled from the cached results
+		RST_STATS(stats_clock::time_point start = stats_clock::now();)
+		size_t count = pos.size();
+		vertex_cache.resize(count);
+		int batches = (int)((count + vertex_batch::size - 1) / vertex_batch::size);
+		auto run_batches = [&](int first_batch, int last_batch) {
+			vertex_batch b;
+			alignas(32) float out[13][vertex_batch::size];
+			for (int bi = first_batch; bi < last_batch; bi++)
+			{
+				size_t first = (size_t)bi * vertex_batch::size;
+				load_batch(pos, col, nor, tan, tex, first, b);
+				batch_shader(b);
+				for (int r = 0; r < 7; r++)
+					transform_row8(rows[r], b.px, b.py, b.pz, out[r]);
+				for (int r = 7; r < 10; r++)
+					transform_row8(rows[r], b.nx, b.ny, b.nz, out[r]);
+				for (int r = 10; r < 13; r++)
+					transform_row8(rows[r], b.tx, b.ty, b.tz, out[r]);
+				for (int l = 0; l < b.count; l++)
+				{
+					clip_vertex &cv = vertex_cache[first + l];
+					cv.pos = Eigen::Vector4f(out[0][l], out[1][l], out[2][l], out[3][l]);
+					cv.view_pos = Eigen::Vector3f(out[4][l], out[5][l], out[6][l]);
+					cv.normal = Eigen::Vector3f(out[7][l], out[8][l], out[9][l]);
+					cv.tangent = Eigen::Vector3f(out[10][l], out[11][l], out[12][l]);
+					cv.tex_coords = Eigen::Vector2f(b.u[l], b.v[l]);
+					cv.color = Eigen::Vector3f(b.r[l], b.g[l], b.b[l]);
+				}
+			}
+		};
+
+		// large meshes are split into jobs of 512 batches across the tile threads
+		const int batches_per_job = 512;
+		int jobs = (batches + batches_per_job - 1) / batches_per_job;
+		if (tiled && jobs > 1)
+		{
+			if (!pool)
+				pool.reset(new ThreadPool());
+			pool->parallel_for(jobs, [&](int job) {
+				run_batches(job * batches_per_job, std::min(batches, (job + 1) * batches_per_job));
+			});
+		}
+		else
+		{
+			run_batches(0, batches);
+		}
+		RST_STATS(counters.add_time(Stage::Vertex, start);)
+	}
+
+	template <typename FragmentShader>
+	void rasterizer::shade_visible(const screen_rect &rect, const FragmentShader &frag_shader)
+	{
+		for (int y = rect.y0; y < rect.y1; y++)
+		{
+			for (int x = rect.x0; x < rect.x1; x++)
+			{
+				int index = get_index(x, y);
+				const visibility &vis = vis_buf[index];
+				if (vis.tri >= 0)
+					shade_pixel(x, y, index, vis.alpha, vis.beta, vis.gamma, vis.tri, frag_shader);
+			}
+		}
+	}
+
+	template <typename FragmentShader>
+	void rasterizer::shade_pixel(int x, int y, int pix, float alpha, float beta, float gamma, int ti, const FragmentShader &frag_shader)
+	{
+		const Triangle &t = post_tris[ti];
+		const std::array<Eigen::Vector3f, 3> &viewspace_pos = post_view_pos[ti];
+		RST_STATS(stats_clock::time_point resolve_start = stats_clock::now();)
+		Eigen::Vector3f color = resolve_pixel(pix);
+		RST_STATS(stats_clock::time_point shade_start = counters.add_time(Stage::Resolve, resolve_start);)
+		Eigen::Vector3f interpolated_normal = alpha * t.normal[0] + beta * t.normal[1] + gamma * t.normal[2];
+		Eigen::Vector2f interpolated_texcoords = alpha * t.tex_coords[0] + beta * t.tex_coords[1] + gamma * t.tex_coords[2];
+		fragment_shader_payload payload(color, interpolated_normal.normalized(), interpolated_texcoords, texture.get());
+		Eigen::Vector3f interpolated_shadingcoords = alpha * viewspace_pos[0] + beta * viewspace_pos[1] + gamma * viewspace_pos[2];
+		payload.view_pos = interpolated_shadingcoords;
+		payload.tangent = alpha * t.tangent[0] + beta * t.tangent[1] + gamma * t.tangent[2];
+		payload.tex_dx = post_tex_grad[ti][0];
+		payload.tex_dy = post_tex_grad[ti][1];
+		payload.uniforms = &uniforms;
+		set_pixel(x, y, frag_shader(payload));
+		RST_STATS(
+			stats_clock::time_point shade_end = counters.add_time(Stage::Shade, shade_start);
+			stats_counters::add(counters.fragments_shaded, 1);
+			if (heatmaps)
+				shade_cost_buf[pix] += std::chrono::duration<float, std::micro>(shade_end - resolve_start).count();
+		)
+	}
 } // namespace rst
@@ -39,23 +39,26 @@ bool rayTriangleIntersect(const Vector3f& v0, const Vector3f& v1,
     return true;
 }
 
+// A triangle of a mesh: three indices into the mesh's shared vertex
+// array, which must outlive it
 class Triangle : public Object
 {
 public:
-    Vector3f v0, v1, v2; // vertices A, B ,C , counter-clockwise order
-    Vector3f e1, e2;     // 2 edges v1-v0, v2-v0;
-    Vector3f t0, t1, t2; // texture coords
+    const Vector3f* vertices;
+    const uint32_t* index; // vertices A, B ,C , counter-clockwise order
     Vector3f normal;
     Material* m;
 
-    Triangle(Vector3f _v0, Vector3f _v1, Vector3f _v2, Material* _m = nullptr)
-        : v0(_v0), v1(_v1), v2(_v2), m(_m)
+    Triangle(const Vector3f* _vertices, const uint32_t* _index, Material* _m = nullptr)
+        : vertices(_vertices), index(_index), m(_m)
     {
-        e1 = v1 - v0;
-        e2 = v2 - v0;
-        normal = normalize(crossProduct(e1, e2));
+        normal = normalize(crossProduct(v1() - v0(), v2() - v0()));
     }
 
+    const Vector3f& v0() const { return vertices[index[0]]; }
+    const Vector3f& v1() const { return vertices[index[1]]; }
+    const Vector3f& v2() const { return vertices[index[2]]; }
+
     bool intersect(const Ray &ray) const override { return true; }
     bool intersect(const Ray &ray, float &tnear, uint32_t &index) const override { return false; }
     Intersection getIntersection(const Ray &ray) override
@@ -64,6 +67,9 @@ public:
 
 		if (dotProduct(ray.direction, normal) > 0)
 			return inter;
+		const Vector3f& v0 = this->v0();
+		Vector3f e1 = v1() - v0;
+		Vector3f e2 = v2() - v0;
 		double u, v, t_tmp = 0;
 		Vector3f pvec = crossProduct(ray.direction, e2);
 		double det = dotProduct(e1, pvec);
@@ -98,7 +104,7 @@ public:
     }
 	
 	Vector3f evalDiffuseColor(const Vector2f &) const override { return Vector3f(0.5, 0.5, 0.5); }
-    Bounds3 getBounds() const override{ return Union(Bounds3(v0, v1), v2); }
+    Bounds3 getBounds() const override{ return Union(Bounds3(v0(), v1()), v2()); }
 };
 
 
@@ -120,43 +126,38 @@ public:
 
     MeshTriangle(const std::string& filename)
     {
-        objl::Loader loader;
-        loader.LoadFile(filename);
-
-        assert(loader.LoadedMeshes.size() == 1);
-        auto mesh = loader.LoadedMeshes[0];
-
-        Vector3f min_vert = Vector3f{std::numeric_limits<float>::infinity(),
-                                     std::numeric_limits<float>::infinity(),
-                                     std::numeric_limits<float>::infinity()};
-        Vector3f max_vert = Vector3f{-std::numeric_limits<float>::infinity(),
-                                     -std::numeric_limits<float>::infinity(),
-                                     -std::numeric_limits<float>::infinity()};
-        for (int i = 0; i < mesh.Vertices.size(); i += 3) {
-            std::array<Vector3f, 3> face_vertices;
-            for (int j = 0; j < 3; j++) {
-                auto vert = Vector3f(mesh.Vertices[i + j].Position.X,
-                                     mesh.Vertices[i + j].Position.Y,
-                                     mesh.Vertices[i + j].Position.Z) * 60.f;
-                face_vertices[j] = vert;
-
-                min_vert = Vector3f(std::min(min_vert.x, vert.x),
-                                    std::min(min_vert.y, vert.y),
-                                    std::min(min_vert.z, vert.z));
-                max_vert = Vector3f(std::max(max_vert.x, vert.x),
-                                    std::max(max_vert.y, vert.y),
-                                    std::max(max_vert.z, vert.z));
-            }
+        // no vertex cache optimization: the BVH decides the triangle order
+        objl::MeshCache mesh;
+        if (!mesh.LoadFile(filename))
+            throw std::runtime_error("cannot load mesh " + filename);
+
+        assert(mesh.MeshCount == 1);
+
+        // shared vertices and indices, as welded by the loader; the
+        // triangles index into them rather than copying their corners
+        numTriangles = mesh.IndexCount / 3;
+        vertices = std::unique_ptr<Vector3f[]>(new Vector3f[mesh.VertexCount]);
+        stCoordinates = std::unique_ptr<Vector2f[]>(new Vector2f[mesh.VertexCount]);
+        vertexIndex = std::unique_ptr<uint32_t[]>(new uint32_t[numTriangles * 3]);
+        for (uint32_t i = 0; i < mesh.VertexCount; i++) {
+            const objl::Vector3& p = mesh.Positions[i];
+            vertices[i] = Vector3f(p.X, p.Y, p.Z) * 60.f;
+            stCoordinates[i] = Vector2f(mesh.TextureCoordinates[i].X, mesh.TextureCoordinates[i].Y);
+        }
+        std::copy(mesh.Indices, mesh.Indices + numTriangles * 3, vertexIndex.get());
 
-            auto new_mat = new Material(MaterialType::DIFFUSE_AND_GLOSSY, Vector3f(0.5, 0.5, 0.5), Vector3f(0, 0, 0));
-            new_mat->Kd = 0.6;
-            new_mat->Ks = 0.0;
-            new_mat->specularExponent = 0;
+        // one material for the whole mesh
+        m = new Material(MaterialType::DIFFUSE_AND_GLOSSY, Vector3f(0.5, 0.5, 0.5), Vector3f(0, 0, 0));
+        m->Kd = 0.6;
+        m->Ks = 0.0;
+        m->specularExponent = 0;
 
-            triangles.emplace_back(face_vertices[0], face_vertices[1], face_vertices[2], new_mat);
-        }
+        triangles.reserve(numTriangles);
+        for (uint32_t k = 0; k < numTriangles; k++)
+            triangles.emplace_back(vertices.get(), &vertexIndex[k * 3], m);
 
-        bounding_box = Bounds3(min_vert, max_vert);
+        bounding_box = Bounds3(Vector3f(mesh.BoundsMin.X, mesh.BoundsMin.Y, mesh.BoundsMin.Z) * 60.f,
+                               Vector3f(mesh.BoundsMax.X, mesh.BoundsMax.Y, mesh.BoundsMax.Z) * 60.f);
 
         std::vector<Object*> ptrs;
         for (auto& tri : triangles)
@@ -24,42 +24,32 @@ public:
 
 	MeshTriangle(const std::string &filename, Material *mt = new Material())
 	{
-		objl::Loader loader;
-		loader.LoadFile(filename);
+		// no vertex cache optimization: the BVH decides the triangle order
+		objl::MeshCache mesh;
+		if (!mesh.LoadFile(filename))
+			throw std::runtime_error("cannot load mesh " + filename);
 		area = 0;
 		m = mt;
-		assert(loader.LoadedMeshes.size() == 1);
-		auto mesh = loader.LoadedMeshes[0];
-
-		Vector3f min_vert = Vector3f{ std::numeric_limits<float>::infinity(),
-									 std::numeric_limits<float>::infinity(),
-									 std::numeric_limits<float>::infinity() };
-		Vector3f max_vert = Vector3f{ -std::numeric_limits<float>::infinity(),
-									 -std::numeric_limits<float>::infinity(),
-									 -std::numeric_limits<float>::infinity() };
-		for (int i = 0; i < mesh.Vertices.size(); i += 3)
+		assert(mesh.MeshCount == 1);
+
+		// shared vertices and indices, as welded by the loader; the
+		// triangles index into them rather than copying their corners
+		numTriangles = mesh.IndexCount / 3;
+		vertices = std::unique_ptr<Vector3f[]>(new Vector3f[mesh.VertexCount]);
+		vertexIndex = std::unique_ptr<uint32_t[]>(new uint32_t[numTriangles * 3]);
+		for (uint32_t i = 0; i < mesh.VertexCount; i++)
 		{
-			std::array<Vector3f, 3> face_vertices;
-
-			for (int j = 0; j < 3; j++)
-			{
-				auto vert = Vector3f(mesh.Vertices[i + j].Position.X,
-					mesh.Vertices[i + j].Position.Y,
-					mesh.Vertices[i + j].Position.Z);
-				face_vertices[j] = vert;
-
-				min_vert = Vector3f(std::min(min_vert.x, vert.x),
-					std::min(min_vert.y, vert.y),
-					std::min(min_vert.z, vert.z));
-				max_vert = Vector3f(std::max(max_vert.x, vert.x),
-					std::max(max_vert.y, vert.y),
-					std::max(max_vert.z, vert.z));
-			}
-
-			triangles.emplace_back(face_vertices[0], face_vertices[1], face_vertices[2], mt);
+			const objl::Vector3 &p = mesh.Positions[i];
+			vertices[i] = Vector3f(p.X, p.Y, p.Z);
 		}
+		std::copy(mesh.Indices, mesh.Indices + numTriangles * 3, vertexIndex.get());
+
+		triangles.reserve(numTriangles);
+		for (uint32_t k = 0; k < numTriangles; k++)
+			triangles.emplace_back(vertices.get(), &vertexIndex[k * 3], mt);
 
-		bounding_box = Bounds3(min_vert, max_vert);
+		bounding_box = Bounds3(Vector3f(mesh.BoundsMin.X, mesh.BoundsMin.Y, mesh.BoundsMin.Z),
+			Vector3f(mesh.BoundsMax.X, mesh.BoundsMax.Y, mesh.BoundsMax.Z));
 
 		std::vector<Object *> ptrs;
 		for (auto &tri : triangles)
@@ -3,27 +3,34 @@
 #include "Material.hpp"
 #include "Hit.hpp"
 
+// A triangle of a mesh: three indices into the mesh's shared vertex
+// array, which must outlive it
 class Triangle : public Object
 {
 public:
-	Vector3f v0, v1, v2; // vertices A, B ,C , counter-clockwise order
-	Vector3f e1, e2;     // 2 edges v1-v0, v2-v0;
-	Vector3f t0, t1, t2; // texture coords
+	const Vector3f *vertices;
+	const uint32_t *index; // vertices A, B ,C , counter-clockwise order
 	Vector3f normal;
 	float area;
 	Material *m;
 
-	Triangle(Vector3f _v0, Vector3f _v1, Vector3f _v2, Material *_m = nullptr)
-		: v0(_v0), v1(_v1), v2(_v2), m(_m)
+	Triangle(const Vector3f *_vertices, const uint32_t *_index, Material *_m = nullptr)
+		: vertices(_vertices), index(_index), m(_m)
 	{
-		e1 = v1 - v0;
-		e2 = v2 - v0;
-		normal = e1.cross(e2).normalize();
-		area = e1.cross(e2).length() * 0.5f;
+		Vector3f n = (v1() - v0()).cross(v2() - v0());
+		normal = n.normalize();
+		area = n.length() * 0.5f;
 	}
 
+	const Vector3f &v0() const { return vertices[index[0]]; }
+	const Vector3f &v1() const { return vertices[index[1]]; }
+	const Vector3f &v2() const { return vertices[index[2]]; }
+
 	bool intersect(const Ray &ray, Hit &hit) const override
 	{
+		const Vector3f &v0 = this->v0();
+		Vector3f e1 = v1() - v0;
+		Vector3f e2 = v2() - v0;
 		Vector3f ro = ray.origin;
 		Vector3f rd = ray.direction;
 		Vector3f s = ro - v0;
@@ -44,11 +51,11 @@ public:
 		return false;
 	}
 
-	Bounds3 getBounds() const override { return Union(Bounds3(v0, v1), v2); }
+	Bounds3 getBounds() const override { return Union(Bounds3(v0(), v1()), v2()); }
 	void Sample(Hit &hit, float &pdf) const override
 	{
 		float x = std::sqrt(get_random_float()), y = get_random_float();
-		hit.p = v0 * (1.0f - x) + v1 * (x * (1.0f - y)) + v2 * (x * y);
+		hit.p = v0() * (1.0f - x) + v1() * (x * (1.0f - y)) + v2() * (x * y);
 		//float u, v;
 		//do
 		//{